@@ -0,0 +1,185 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "error.h"
+#include "wrapper.h"
+
+/* Alignment of arena_alloc, enough for any type we store */
+#define ARENA_ALIGN (2 * sizeof(void *))
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t used;
+	size_t sz;
+	char data[];
+};
+
+struct arena *arena_new(size_t chunksz)
+{
+	struct arena *arena = xcalloc(1, sizeof(struct arena));
+	arena->chunksz = chunksz;
+	return arena;
+}
+
+void arena_free(struct arena *arena)
+{
+	struct arena_chunk *chunk;
+
+	if (!arena) {
+		return;
+	}
+
+	while (arena->chunk) {
+		chunk = arena->chunk;
+		arena->chunk = chunk->next;
+		free(chunk);
+	}
+
+	free(arena);
+}
+
+/* Starts a new chunk with room for at least sz bytes at the given alignment.
+ * Oversized requests get a chunk of their own.
+ */
+static struct arena_chunk *arena_grow(struct arena *arena, size_t sz, size_t align)
+{
+	struct arena_chunk *chunk;
+	size_t chunksz = sz + align > arena->chunksz ? sz + align : arena->chunksz;
+
+	chunk = xmalloc(sizeof(struct arena_chunk) + chunksz);
+	chunk->used = 0;
+	chunk->sz = chunksz;
+
+	/* New chunks always go in front so that arena_reset can walk back */
+	chunk->next = arena->chunk;
+	arena->chunk = chunk;
+	return chunk;
+}
+
+static void *arena_bump(struct arena *arena, size_t sz, size_t align)
+{
+	struct arena_chunk *chunk = arena->chunk;
+	uintptr_t base, pos;
+
+	if (chunk) {
+		base = (uintptr_t) chunk->data;
+		pos = (base + chunk->used + align - 1) & ~(uintptr_t) (align - 1);
+		if (pos + sz <= base + chunk->sz) {
+			chunk->used = pos + sz - base;
+			return (void *) pos;
+		}
+	}
+
+	chunk = arena_grow(arena, sz, align);
+	base = (uintptr_t) chunk->data;
+	pos = (base + align - 1) & ~(uintptr_t) (align - 1);
+	chunk->used = pos + sz - base;
+	return (void *) pos;
+}
+
+void *arena_alloc(struct arena *arena, size_t sz)
+{
+	return arena_bump(arena, sz, ARENA_ALIGN);
+}
+
+void *arena_calloc(struct arena *arena, size_t nmemb, size_t sz)
+{
+	void *ptr;
+
+	if (sz && nmemb > SIZE_MAX / sz) {
+		die("arena_calloc: size overflow");
+	}
+
+	ptr = arena_bump(arena, nmemb * sz, ARENA_ALIGN);
+	memset(ptr, 0, nmemb * sz);
+	return ptr;
+}
+
+void *arena_memdup(struct arena *arena, const void *data, size_t sz)
+{
+	void *ptr = arena_bump(arena, sz, ARENA_ALIGN);
+	memcpy(ptr, data, sz);
+	return ptr;
+}
+
+char *arena_strndup(struct arena *arena, const char *str, size_t len)
+{
+	char *ptr;
+
+	if (!str) {
+		return NULL;
+	}
+
+	len = strnlen(str, len);
+	ptr = arena_bump(arena, len + 1, 1);
+	memcpy(ptr, str, len);
+	ptr[len] = 0;
+	return ptr;
+}
+
+char *arena_strdup(struct arena *arena, const char *str)
+{
+	if (!str) {
+		return NULL;
+	}
+
+	return arena_strndup(arena, str, strlen(str));
+}
+
+void arena_mark(struct arena *arena, struct arena_mark *mark)
+{
+	mark->chunk = arena->chunk;
+	mark->used = arena->chunk ? arena->chunk->used : 0;
+}
+
+void arena_reset(struct arena *arena, struct arena_mark *mark)
+{
+	struct arena_chunk *chunk;
+
+	while (arena->chunk && arena->chunk != mark->chunk) {
+		chunk = arena->chunk;
+		arena->chunk = chunk->next;
+		free(chunk);
+	}
+
+	if (arena->chunk) {
+		arena->chunk->used = mark->used;
+	}
+}
+
+void arena_splice(struct arena *dst, struct arena *src)
+{
+	struct arena_chunk *tail;
+
+	if (!src->chunk) {
+		free(src);
+		return;
+	}
+
+	/* Keep dst's current chunk in front so that it is filled up first */
+	for (tail = src->chunk; tail->next; tail = tail->next)
+		;
+
+	if (dst->chunk) {
+		tail->next = dst->chunk->next;
+		dst->chunk->next = src->chunk;
+	} else {
+		dst->chunk = src->chunk;
+	}
+
+	src->chunk = NULL;
+	free(src);
+}
+
+void arena_usage(struct arena *arena, size_t *used, size_t *total)
+{
+	struct arena_chunk *chunk;
+
+	*used = *total = 0;
+	for (chunk = arena->chunk; chunk; chunk = chunk->next) {
+		*used += chunk->used;
+		*total += chunk->sz;
+	}
+}
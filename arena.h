@@ -0,0 +1,50 @@
+#ifndef POWAUR_ARENA_H
+#define POWAUR_ARENA_H
+
+#include <stddef.h>
+
+/* Opaque */
+struct arena_chunk;
+
+/* Bump pointer allocator.
+ * Memory is carved out of large chunks and is only given back all at once,
+ * either by arena_reset to an earlier mark or by arena_free.
+ */
+struct arena {
+	struct arena_chunk *chunk;
+	size_t chunksz;
+};
+
+/* Position in an arena, for arena_reset */
+struct arena_mark {
+	struct arena_chunk *chunk;
+	size_t used;
+};
+
+struct arena *arena_new(size_t chunksz);
+void arena_free(struct arena *arena);
+
+/* Returns sz bytes suitably aligned for any type. Never fails */
+void *arena_alloc(struct arena *arena, size_t sz);
+void *arena_calloc(struct arena *arena, size_t nmemb, size_t sz);
+void *arena_memdup(struct arena *arena, const void *data, size_t sz);
+
+/* Strings are packed without padding */
+char *arena_strdup(struct arena *arena, const char *str);
+char *arena_strndup(struct arena *arena, const char *str, size_t len);
+
+/* Records the current position of arena in mark */
+void arena_mark(struct arena *arena, struct arena_mark *mark);
+
+/* Releases everything allocated since mark was taken */
+void arena_reset(struct arena *arena, struct arena_mark *mark);
+
+/* Hands all chunks of src over to dst and frees src.
+ * Marks taken on either arena before are no longer valid.
+ */
+void arena_splice(struct arena *dst, struct arena *src);
+
+/* Number of bytes handed out, and held in chunks */
+void arena_usage(struct arena *arena, size_t *used, size_t *total);
+
+#endif
@@ -0,0 +1,641 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <alpm.h>
+
+#include "build.h"
+#include "conf.h"
+#include "environment.h"
+#include "error.h"
+#include "powaur.h"
+#include "util.h"
+#include "wrapper.h"
+
+/* Where background makepkg runs write their output, inside the package
+ * directory
+ */
+#define BUILD_LOG    "makepkg.log"
+#define PREFETCH_LOG "prefetch.log"
+
+char **list_to_argv(alpm_list_t *args)
+{
+	alpm_list_t *i;
+	int cnt, total;
+
+	total = alpm_list_count(args);
+	if (!total) {
+		return NULL;
+	}
+
+	total++;
+	char **argv = xcalloc(total, sizeof(char *));
+	for (cnt = 0, i = args; i; i = i->next) {
+		argv[cnt++] = i->data;
+	}
+
+	argv[cnt] = NULL;
+	return argv;
+}
+
+/* Forks the editor on file and waits for it.
+ * returns 0 on success, -1 on failure.
+ */
+static int edit_file(const char *file)
+{
+	pid_t pid = fork();
+	if (pid == (pid_t) -1) {
+		return error(PW_ERR_FORK_FAILED);
+	} else if (pid == 0) {
+		execlp(powaur_editor, powaur_editor, file, NULL);
+		_exit(127);
+	}
+
+	return wait_or_whine(pid, powaur_editor) ? -1 : 0;
+}
+
+int build_review(const char *pkgname)
+{
+	static const char choices[] = {'y', 'n', 'a', 'Y', 'N', 'A'};
+	int ret = 0;
+	char cwd[PATH_MAX];
+	char buf[PATH_MAX];
+	char *dotinstall = NULL;
+
+	if (config->noconfirm) {
+		return 0;
+	}
+
+	if (!getcwd(cwd, PATH_MAX)) {
+		return error(PW_ERR_GETCWD);
+	}
+
+	if (chdir(pkgname)) {
+		return error(PW_ERR_CHDIR, pkgname);
+	}
+
+	/* Ask user to edit PKGBUILD */
+	snprintf(buf, PATH_MAX, "Edit PKGBUILD for %s? [Y/n/a]", pkgname);
+	switch (mcq(buf, choices, sizeof(choices) / sizeof(*choices), 0)) {
+	case 1:
+		break;
+	case 2:
+		/* Abort, propagate upwards */
+		ret = -2;
+		goto cleanup;
+	default:
+		if (edit_file("PKGBUILD")) {
+			ret = -1;
+			goto cleanup;
+		}
+	}
+
+	/* Check if we have .install file */
+	dotinstall = have_dotinstall();
+	if (dotinstall) {
+		snprintf(buf, PATH_MAX, "Edit .install for %s? [Y/n/a]", pkgname);
+		switch (mcq(buf, choices, sizeof(choices) / sizeof(*choices), 0)) {
+		case 1:
+			break;
+		case 2:
+			ret = -2;
+			goto cleanup;
+		default:
+			if (edit_file(dotinstall)) {
+				ret = -1;
+				goto cleanup;
+			}
+		}
+	}
+
+	if (!yesno("Continue installing %s?", pkgname)) {
+		ret = -2;
+	}
+
+cleanup:
+	free(dotinstall);
+
+	/* Change back to old directory */
+	if (chdir(cwd)) {
+		RET_ERR(PW_ERR_RESTORECWD, -2);
+	}
+
+	return ret;
+}
+
+/* Starts makepkg with the given mode flags inside the pkgname directory.
+ * If log is not NULL, output goes to that file and stdin is /dev/null.
+ *
+ * returns the pid of makepkg, -1 on failure.
+ */
+static pid_t makepkg_spawn(const char *pkgname, const char *mode, const char *log)
+{
+	sigset_t sigchld;
+	alpm_list_t *args;
+	char **argv;
+	pid_t pid;
+	int fd;
+
+	args = alpm_list_add(NULL, xstrdup("makepkg"));
+	alpm_list_add(args, xstrdup(mode));
+
+	if (config->noconfirm) {
+		alpm_list_add(args, xstrdup("--noconfirm"));
+	}
+
+	/* Check if we're root. Invoke makepkg with --asroot if so */
+	if (geteuid() == 0) {
+		alpm_list_add(args, xstrdup("--asroot"));
+	}
+
+	argv = list_to_argv(args);
+	pid = fork();
+	if (pid == (pid_t) -1) {
+		error(PW_ERR_FORK_FAILED);
+	} else if (pid == 0) {
+		/* build_levels blocks SIGCHLD, makepkg must not inherit that */
+		sigemptyset(&sigchld);
+		sigaddset(&sigchld, SIGCHLD);
+		sigprocmask(SIG_UNBLOCK, &sigchld, NULL);
+
+		if (chdir(pkgname)) {
+			_exit(127);
+		}
+
+		if (log) {
+			fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (fd < 0) {
+				_exit(127);
+			}
+
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+
+			fd = open("/dev/null", O_RDONLY);
+			if (fd >= 0) {
+				dup2(fd, STDIN_FILENO);
+				close(fd);
+			}
+		}
+
+		execvp("makepkg", argv);
+		_exit(127);
+	}
+
+	free(argv);
+	FREELIST(args);
+	return pid;
+}
+
+/* Runs makepkg in the foreground.
+ * returns 0 on success, -1 on failure.
+ */
+static int makepkg_run(const char *pkgname, const char *mode)
+{
+	pid_t pid = makepkg_spawn(pkgname, mode, NULL);
+	if (pid == (pid_t) -1) {
+		return -1;
+	}
+
+	return wait_or_whine(pid, "makepkg") ? -1 : 0;
+}
+
+int build_install(const char *pkgname)
+{
+	return makepkg_run(pkgname, "-si");
+}
+
+/* A makepkg build running in the background */
+struct build_job {
+	const char *pkgname;
+	pid_t pid;
+	int ret;
+};
+
+/* Only there so that SIGCHLD interrupts sigsuspend */
+static void build_sigchld(int sig)
+{
+}
+
+/* Waits for any of the running jobs to finish. Only the pids of jobs are
+ * waited for, children of the prefetcher are left to it.
+ * SIGCHLD must be blocked by the caller, waitmask is the mask to sleep with.
+ *
+ * returns the job, NULL if waitpid failed.
+ */
+static struct build_job *build_wait(struct build_job *jobs, int nr,
+									const sigset_t *waitmask)
+{
+	int status, i;
+	pid_t pid;
+
+	for (;;) {
+		for (i = 0; i < nr; ++i) {
+			if (jobs[i].pid <= 0) {
+				continue;
+			}
+
+			pid = waitpid(jobs[i].pid, &status, WNOHANG);
+			if (pid < 0 && errno != EINTR) {
+				error(PW_ERR_WAITPID_FAILED);
+				return NULL;
+			} else if (pid == jobs[i].pid) {
+				jobs[i].pid = 0;
+				jobs[i].ret = WIFEXITED(status) && !WEXITSTATUS(status) ? 0 : -1;
+				return &jobs[i];
+			}
+		}
+
+		/* A child exiting after the checks above leaves SIGCHLD pending,
+		 * so this returns right away instead of missing it.
+		 */
+		sigsuspend(waitmask);
+	}
+}
+
+/* Fetches the sources of packages in the background, in build order, so
+ * that downloads overlap with the builds before them.
+ */
+struct build_prefetch {
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/* Package names in build order */
+	const char **pkgs;
+	int nr;
+
+	/* Number of packages done, fetched or not */
+	int done;
+	int stop;
+};
+
+static void *thread_prefetch(void *arg)
+{
+	struct build_prefetch *pf = arg;
+	const char *pkgname;
+	pid_t pid;
+	int idx, ret;
+
+	for (idx = 0; idx < pf->nr; ++idx) {
+		pthread_mutex_lock(&pf->lock);
+		if (pf->stop) {
+			pthread_mutex_unlock(&pf->lock);
+			break;
+		}
+		pthread_mutex_unlock(&pf->lock);
+
+		/* Downloads and checks the sources, without extracting them */
+		pkgname = pf->pkgs[idx];
+		pid = makepkg_spawn(pkgname, "--verifysource", PREFETCH_LOG);
+		ret = pid == (pid_t) -1 ? -1 : wait_or_whine(pid, "makepkg");
+		pw_printf(PW_LOG_DEBUG, "Prefetching sources for %s %s\n", pkgname,
+				  ret ? "failed" : "done");
+
+		pthread_mutex_lock(&pf->lock);
+		pf->done = idx + 1;
+		pthread_cond_broadcast(&pf->cond);
+		pthread_mutex_unlock(&pf->lock);
+	}
+
+	/* Let waiters through if we stopped early */
+	pthread_mutex_lock(&pf->lock);
+	pf->done = pf->nr;
+	pthread_cond_broadcast(&pf->cond);
+	pthread_mutex_unlock(&pf->lock);
+	return NULL;
+}
+
+/* returns 1 if the makepkg.conf at path assigns SRCDEST, 0 otherwise */
+static int conf_sets_srcdest(const char *path)
+{
+	FILE *fp;
+	char buf[PATH_MAX];
+	char *line;
+	int ret = 0;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		return 0;
+	}
+
+	while (!ret && fgets(buf, PATH_MAX, fp)) {
+		line = strtrim(buf);
+		if (!strncmp(line, "export ", 7)) {
+			line = strtrim(line + 7);
+		}
+
+		ret = !strncmp(line, "SRCDEST=", 8);
+	}
+
+	fclose(fp);
+	return ret;
+}
+
+/* returns 1 if any of the files makepkg reads its configuration from
+ * assigns SRCDEST, 0 otherwise
+ */
+static int makepkg_conf_srcdest(void)
+{
+	DIR *dirp;
+	struct dirent *dirent;
+	const char *env, *home;
+	char path[PATH_MAX];
+	size_t len;
+	int ret = 0;
+
+	env = getenv("MAKEPKG_CONF");
+	if (conf_sets_srcdest(env ? env : "/etc/makepkg.conf")) {
+		return 1;
+	}
+
+	dirp = opendir("/etc/makepkg.conf.d");
+	if (dirp) {
+		while (!ret && (dirent = readdir(dirp))) {
+			len = strlen(dirent->d_name);
+			if (len > 5 && !strcmp(dirent->d_name + len - 5, ".conf")) {
+				snprintf(path, PATH_MAX, "/etc/makepkg.conf.d/%s", dirent->d_name);
+				ret = conf_sets_srcdest(path);
+			}
+		}
+
+		closedir(dirp);
+		if (ret) {
+			return 1;
+		}
+	}
+
+	home = getenv("HOME");
+	env = getenv("XDG_CONFIG_HOME");
+	if (env) {
+		snprintf(path, PATH_MAX, "%s/pacman/makepkg.conf", env);
+		ret = conf_sets_srcdest(path);
+	} else if (home) {
+		snprintf(path, PATH_MAX, "%s/.config/pacman/makepkg.conf", home);
+		ret = conf_sets_srcdest(path);
+	}
+
+	if (!ret && home) {
+		snprintf(path, PATH_MAX, "%s/.makepkg.conf", home);
+		ret = conf_sets_srcdest(path);
+	}
+
+	return ret;
+}
+
+/* Points makepkg at a source directory shared by all packages, unless the
+ * user has picked one, in the environment or in makepkg.conf.
+ */
+static void setup_srcdest(void)
+{
+	char dir[PATH_MAX];
+
+	if (getenv("SRCDEST") || makepkg_conf_srcdest()) {
+		return;
+	}
+
+	snprintf(dir, PATH_MAX, "%s/%s", powaur_dir, PW_SRCDEST_DIR);
+	if (mkdir(dir, 0755) && errno != EEXIST) {
+		pw_printf(PW_LOG_DEBUG, "Unable to create %s, sources are not shared\n",
+				  dir);
+		return;
+	}
+
+	setenv("SRCDEST", dir, 1);
+}
+
+/* Starts prefetching the sources of pkgs, in order.
+ * returns NULL if the thread cannot be started.
+ */
+static struct build_prefetch *prefetch_start(alpm_list_t **levels, int nlevels)
+{
+	struct build_prefetch *pf;
+	alpm_list_t *i;
+	int lvl, nr = 0;
+
+	for (lvl = 0; lvl < nlevels; ++lvl) {
+		nr += alpm_list_count(levels[lvl]);
+	}
+
+	/* Nothing to overlap the first build with */
+	if (nr < 2) {
+		return NULL;
+	}
+
+	pf = xcalloc(1, sizeof(struct build_prefetch));
+	pf->pkgs = xcalloc(nr, sizeof(char *));
+	for (lvl = 0; lvl < nlevels; ++lvl) {
+		for (i = levels[lvl]; i; i = i->next) {
+			pf->pkgs[pf->nr++] = i->data;
+		}
+	}
+
+	pthread_mutex_init(&pf->lock, NULL);
+	pthread_cond_init(&pf->cond, NULL);
+	if (pthread_create(&pf->tid, NULL, thread_prefetch, pf)) {
+		pthread_mutex_destroy(&pf->lock);
+		pthread_cond_destroy(&pf->cond);
+		free(pf->pkgs);
+		free(pf);
+		return NULL;
+	}
+
+	return pf;
+}
+
+/* Waits until the sources of the idx-th package have been fetched, so that
+ * makepkg does not download them a second time.
+ */
+static void prefetch_wait(struct build_prefetch *pf, int idx)
+{
+	if (!pf) {
+		return;
+	}
+
+	pthread_mutex_lock(&pf->lock);
+	while (pf->done <= idx) {
+		pthread_cond_wait(&pf->cond, &pf->lock);
+	}
+	pthread_mutex_unlock(&pf->lock);
+}
+
+/* Stops after the current fetch and frees pf */
+static void prefetch_stop(struct build_prefetch *pf)
+{
+	if (!pf) {
+		return;
+	}
+
+	pthread_mutex_lock(&pf->lock);
+	pf->stop = 1;
+	pthread_mutex_unlock(&pf->lock);
+
+	pthread_join(pf->tid, NULL);
+	pthread_mutex_destroy(&pf->lock);
+	pthread_cond_destroy(&pf->cond);
+	free(pf->pkgs);
+	free(pf);
+}
+
+/* Builds the packages of one level, up to jobs at a time, then installs
+ * the ones which built in order.
+ *
+ * @param first position of the level's first package in build order
+ * @param waitmask signal mask for build_wait
+ */
+static int build_level(struct build_prefetch *pf, int first, alpm_list_t *level,
+					   int jobs, const sigset_t *waitmask)
+{
+	struct build_job *job, *all;
+	alpm_list_t *i;
+	int nr, idx, running, ret = 0;
+
+	/* Dependencies are installed through pacman, which cannot run more
+	 * than once at a time. Fetch sources and dependencies up front.
+	 */
+	nr = alpm_list_count(level);
+	all = xcalloc(nr, sizeof(struct build_job));
+	for (idx = 0, i = level; i; i = i->next, ++idx) {
+		prefetch_wait(pf, first + idx);
+		all[idx].pkgname = i->data;
+		all[idx].ret = makepkg_run(i->data, "-so");
+		if (all[idx].ret) {
+			pw_fprintf(PW_LOG_ERROR, stderr, "Failed to prepare %s\n",
+					   (const char *) i->data);
+			ret = -1;
+		}
+	}
+
+	/* Build from the extracted sources */
+	idx = running = 0;
+	while (idx < nr || running) {
+		while (idx < nr && running < jobs) {
+			job = &all[idx++];
+			if (job->ret) {
+				continue;
+			}
+
+			pw_printf(PW_LOG_INFO, "Building %s\n", job->pkgname);
+			job->pid = makepkg_spawn(job->pkgname, "-ef", BUILD_LOG);
+			if (job->pid == (pid_t) -1) {
+				job->pid = 0;
+				job->ret = -1;
+				continue;
+			}
+
+			++running;
+		}
+
+		if (!running) {
+			break;
+		}
+
+		job = build_wait(all, nr, waitmask);
+		if (!job) {
+			ret = -2;
+			break;
+		}
+
+		--running;
+		if (job->ret) {
+			pw_fprintf(PW_LOG_ERROR, stderr, "Failed to build %s, see %s/%s\n",
+					   job->pkgname, job->pkgname, BUILD_LOG);
+			ret = -1;
+		} else {
+			pw_printf(PW_LOG_INFO, "Built %s\n", job->pkgname);
+		}
+	}
+
+	/* Reap whatever is left if waiting failed */
+	for (idx = 0; idx < nr; ++idx) {
+		if (all[idx].pid > 0) {
+			wait_or_whine(all[idx].pid, "makepkg");
+		}
+	}
+
+	/* makepkg -i installs an already built package without building again */
+	for (idx = 0; ret != -2 && idx < nr; ++idx) {
+		if (!all[idx].ret && makepkg_run(all[idx].pkgname, "-i")) {
+			ret = -1;
+		}
+	}
+
+	free(all);
+	return ret;
+}
+
+int build_levels(alpm_list_t **levels, int nlevels, int jobs)
+{
+	struct build_prefetch *pf;
+	struct sigaction sa, oldsa;
+	sigset_t sigchld, oldmask, waitmask;
+	alpm_list_t *i;
+	int lvl, pos, ret = 0;
+
+	setup_srcdest();
+
+	/* SIGCHLD stays blocked, except while build_wait sleeps. The prefetch
+	 * thread inherits the mask, so the signal always wakes this thread.
+	 */
+	memset(&sa, 0, sizeof(struct sigaction));
+	sa.sa_handler = build_sigchld;
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, &oldsa);
+
+	sigemptyset(&sigchld);
+	sigaddset(&sigchld, SIGCHLD);
+	pthread_sigmask(SIG_BLOCK, &sigchld, &oldmask);
+	waitmask = oldmask;
+	sigdelset(&waitmask, SIGCHLD);
+
+	pf = prefetch_start(levels, nlevels);
+
+	for (pos = lvl = 0; lvl < nlevels; ++lvl) {
+		if (!levels[lvl]) {
+			continue;
+		}
+
+		pw_printf(PW_LOG_DEBUG, "Level %d: %d packages\n", lvl,
+				  (int) alpm_list_count(levels[lvl]));
+
+		/* Nothing to overlap, keep the output on the terminal */
+		if (!levels[lvl]->next || jobs <= 1) {
+			for (i = levels[lvl]; i; i = i->next, ++pos) {
+				prefetch_wait(pf, pos);
+				if (build_install(i->data)) {
+					ret = -1;
+				}
+			}
+
+			continue;
+		}
+
+		switch (build_level(pf, pos, levels[lvl], jobs, &waitmask)) {
+		case -2:
+			ret = -2;
+			goto cleanup;
+		case -1:
+			ret = -1;
+			break;
+		}
+
+		pos += alpm_list_count(levels[lvl]);
+	}
+
+cleanup:
+	prefetch_stop(pf);
+	pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+	sigaction(SIGCHLD, &oldsa, NULL);
+	return ret;
+}
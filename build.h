@@ -0,0 +1,43 @@
+#ifndef POWAUR_BUILD_H
+#define POWAUR_BUILD_H
+
+#include <alpm_list.h>
+
+/* Converts a list of strings into an array of char * terminated by NULL.
+ * The returned pointer is to be freed by the caller.
+ */
+char **list_to_argv(alpm_list_t *args);
+
+/* Lets the user review and edit the PKGBUILD and .install of pkgname.
+ * Assumes that the package has been extracted into its own directory.
+ *
+ * returns 0 if the package is to be installed
+ * returns -1 for errors, -2 if the user aborted
+ */
+int build_review(const char *pkgname);
+
+/* Builds and installs a single reviewed package with makepkg -si
+ *
+ * returns 0 if installation is successful
+ * returns -1 for errors, -2 for fatal errors
+ */
+int build_install(const char *pkgname);
+
+/* Builds and installs packages level by level, see graph_levels.
+ * Packages of a level are built by up to jobs makepkg processes at once,
+ * with their output going to makepkg.log in their directories. A level is
+ * installed before the next one is built.
+ *
+ * Meanwhile, the sources of later packages are fetched in build order by
+ * a background thread, logging to prefetch.log. Unless SRCDEST is set in
+ * the environment or in makepkg.conf, it is pointed at a sources directory
+ * under the powaur directory, which --cache --clean empties.
+ *
+ * @param levels array of nlevels lists of reviewed package names
+ * @param nlevels number of levels
+ * @param jobs maximum number of concurrent builds
+ * returns 0 on success, -1 if some packages failed, -2 for fatal errors
+ */
+int build_levels(alpm_list_t **levels, int nlevels, int jobs);
+
+#endif
@@ -0,0 +1,662 @@
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#include <curl/curl.h>
+
+#include "cache.h"
+#include "environment.h"
+#include "powaur.h"
+#include "util.h"
+#include "wrapper.h"
+
+#define CACHE_META_EXT ".meta"
+#define CACHE_HDR_LEN  256
+
+struct cache_entry {
+	char *name;
+	char path[PATH_MAX];
+	char metapath[PATH_MAX];
+	char tmppath[PATH_MAX];
+	char metatmppath[PATH_MAX];
+	FILE *tmp;
+	int failed;
+
+	/* Validators of the cached copy, and the body they belong to */
+	int have_copy;
+	char etag[CACHE_HDR_LEN];
+	char lastmod[CACHE_HDR_LEN];
+	unsigned long body_ino;
+	unsigned long body_size;
+
+	/* Validators of the response */
+	char new_etag[CACHE_HDR_LEN];
+	char new_lastmod[CACHE_HDR_LEN];
+
+	struct curl_slist *headers;
+};
+
+/* Set once something has been added to the cache */
+static int cache_dirty = 0;
+
+/* Set once an RPC response has been stored during this run */
+static int rpc_dirty = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Writes the cache directory into buf, creating it if need be.
+ * returns 0 on success, -1 on failure.
+ */
+static int cache_dir(char *buf, size_t sz)
+{
+	struct stat st;
+
+	snprintf(buf, sz, "%s/%s", powaur_dir, PW_CACHE_DIR);
+	if (!stat(buf, &st)) {
+		return 0;
+	}
+
+	if (mkdir(buf, 0755) && errno != EEXIST) {
+		pw_fprintf(PW_LOG_ERROR, stderr, "Failed to create cache dir %s\n", buf);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int is_meta(const char *filename)
+{
+	size_t len = strlen(filename);
+	size_t extlen = strlen(CACHE_META_EXT);
+	return len > extlen && !strcmp(filename + len - extlen, CACHE_META_EXT);
+}
+
+/* Copies header value into dst, dropping trailing whitespace */
+static void copy_hdr(char *dst, const char *val, size_t len)
+{
+	while (len && (*val == ' ' || *val == '\t')) {
+		++val;
+		--len;
+	}
+
+	while (len && (val[len - 1] == '\r' || val[len - 1] == '\n' ||
+				   val[len - 1] == ' ')) {
+		--len;
+	}
+
+	if (len >= CACHE_HDR_LEN) {
+		len = CACHE_HDR_LEN - 1;
+	}
+
+	memcpy(dst, val, len);
+	dst[len] = 0;
+}
+
+static void read_meta(struct cache_entry *entry)
+{
+	FILE *fp;
+	char buf[PATH_MAX];
+	char *line;
+
+	fp = fopen(entry->metapath, "r");
+	if (!fp) {
+		return;
+	}
+
+	while ((line = fgets(buf, PATH_MAX, fp))) {
+		if (!strncmp(line, "ETag:", 5)) {
+			copy_hdr(entry->etag, line + 5, strlen(line + 5));
+		} else if (!strncmp(line, "Last-Modified:", 14)) {
+			copy_hdr(entry->lastmod, line + 14, strlen(line + 14));
+		} else if (!strncmp(line, "Body:", 5)) {
+			sscanf(line + 5, "%lu %lu", &entry->body_ino, &entry->body_size);
+		}
+	}
+
+	fclose(fp);
+}
+
+struct cache_entry *cache_entry_open(const char *name)
+{
+	struct cache_entry *entry;
+	struct stat st;
+	char dir[PATH_MAX];
+
+	if (!config->cachesize || strchr(name, '/') || name[0] == '.') {
+		return NULL;
+	}
+
+	if (cache_dir(dir, PATH_MAX)) {
+		return NULL;
+	}
+
+	entry = xcalloc(1, sizeof(struct cache_entry));
+	entry->name = xstrdup(name);
+	snprintf(entry->path, PATH_MAX, "%s/%s", dir, name);
+	snprintf(entry->metapath, PATH_MAX, "%s/%s%s", dir, name, CACHE_META_EXT);
+	snprintf(entry->tmppath, PATH_MAX, "%s/.%s.XXXXXX", dir, name);
+	snprintf(entry->metatmppath, PATH_MAX, "%s/.%s%s.XXXXXX", dir, name,
+			 CACHE_META_EXT);
+
+	/* Validators only count for the body they were stored with */
+	if (!stat(entry->path, &st)) {
+		read_meta(entry);
+		entry->have_copy = (entry->etag[0] || entry->lastmod[0]) &&
+			entry->body_ino == (unsigned long) st.st_ino &&
+			entry->body_size == (unsigned long) st.st_size;
+	}
+
+	return entry;
+}
+
+void cache_entry_close(struct cache_entry *entry)
+{
+	if (!entry) {
+		return;
+	}
+
+	if (entry->tmp) {
+		fclose(entry->tmp);
+		unlink(entry->tmppath);
+	}
+
+	curl_slist_free_all(entry->headers);
+	free(entry->name);
+	free(entry);
+}
+
+/* curl HEADERFUNCTION, picks up the validators of the response */
+static size_t cache_header(char *ptr, size_t sz, size_t nmemb, void *userdata)
+{
+	struct cache_entry *entry = userdata;
+	size_t len = sz * nmemb;
+
+	/* Start of a new response, eg. after a redirect */
+	if (len >= 5 && !strncmp(ptr, "HTTP/", 5)) {
+		entry->new_etag[0] = entry->new_lastmod[0] = 0;
+	} else if (len > 5 && !strncasecmp(ptr, "ETag:", 5)) {
+		copy_hdr(entry->new_etag, ptr + 5, len - 5);
+	} else if (len > 14 && !strncasecmp(ptr, "Last-Modified:", 14)) {
+		copy_hdr(entry->new_lastmod, ptr + 14, len - 14);
+	}
+
+	return len;
+}
+
+void cache_entry_setopt(struct cache_entry *entry, CURL *curl)
+{
+	char buf[CACHE_HDR_LEN + 32];
+
+	if (!entry) {
+		return;
+	}
+
+	curl_slist_free_all(entry->headers);
+	entry->headers = NULL;
+
+	if (entry->have_copy) {
+		if (entry->etag[0]) {
+			snprintf(buf, sizeof(buf), "If-None-Match: %s", entry->etag);
+			entry->headers = curl_slist_append(entry->headers, buf);
+		}
+
+		if (entry->lastmod[0]) {
+			snprintf(buf, sizeof(buf), "If-Modified-Since: %s", entry->lastmod);
+			entry->headers = curl_slist_append(entry->headers, buf);
+		}
+
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, entry->headers);
+	}
+
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, cache_header);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, entry);
+}
+
+int cache_entry_write(struct cache_entry *entry, const void *ptr, size_t sz)
+{
+	int fd;
+
+	if (!entry || entry->failed) {
+		return -1;
+	}
+
+	if (!entry->tmp) {
+		fd = mkstemp(entry->tmppath);
+		if (fd < 0 || !(entry->tmp = fdopen(fd, "w"))) {
+			if (fd >= 0) {
+				close(fd);
+				unlink(entry->tmppath);
+			}
+
+			entry->failed = 1;
+			return -1;
+		}
+	}
+
+	if (fwrite(ptr, 1, sz, entry->tmp) != sz) {
+		entry->failed = 1;
+		return -1;
+	}
+
+	return 0;
+}
+
+int cache_entry_commit(struct cache_entry *entry)
+{
+	FILE *fp;
+	struct stat st;
+	int fd, ret;
+
+	if (!entry || !entry->tmp) {
+		return -1;
+	}
+
+	ret = fflush(entry->tmp) || fstat(fileno(entry->tmp), &st);
+	ret = fclose(entry->tmp) || ret;
+	entry->tmp = NULL;
+
+	/* Without validators, there is no way to revalidate the entry */
+	if (ret || entry->failed || (!entry->new_etag[0] && !entry->new_lastmod[0])) {
+		unlink(entry->tmppath);
+		return -1;
+	}
+
+	/* The meta names the body it belongs to. Validators paired with another
+	 * body, after a crash or with two runs storing the same entry, are
+	 * ignored by cache_entry_open.
+	 */
+	fd = mkstemp(entry->metatmppath);
+	if (fd < 0 || !(fp = fdopen(fd, "w"))) {
+		if (fd >= 0) {
+			close(fd);
+			unlink(entry->metatmppath);
+		}
+
+		goto error;
+	}
+
+	if (entry->new_etag[0]) {
+		fprintf(fp, "ETag: %s\n", entry->new_etag);
+	}
+
+	if (entry->new_lastmod[0]) {
+		fprintf(fp, "Last-Modified: %s\n", entry->new_lastmod);
+	}
+
+	fprintf(fp, "Body: %lu %lu\n", (unsigned long) st.st_ino,
+			(unsigned long) st.st_size);
+	ret = ferror(fp);
+	if (fclose(fp) || ret) {
+		unlink(entry->metatmppath);
+		goto error;
+	}
+
+	/* Body first, so new validators never sit next to an old body */
+	if (rename(entry->tmppath, entry->path)) {
+		unlink(entry->metatmppath);
+		goto error;
+	}
+
+	if (rename(entry->metatmppath, entry->metapath)) {
+		unlink(entry->metatmppath);
+		unlink(entry->metapath);
+		return -1;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	cache_dirty = 1;
+	pthread_mutex_unlock(&cache_lock);
+
+	pw_printf(PW_LOG_DEBUG, "cache: stored %s\n", entry->name);
+	return 0;
+
+error:
+	unlink(entry->tmppath);
+	unlink(entry->metapath);
+	return -1;
+}
+
+const char *cache_entry_hit(struct cache_entry *entry)
+{
+	if (!entry || !entry->have_copy) {
+		return NULL;
+	}
+
+	/* mtime is the LRU clock */
+	utime(entry->path, NULL);
+	pw_printf(PW_LOG_DEBUG, "cache: %s not modified\n", entry->name);
+	return entry->path;
+}
+
+/* Writes the path of the cached response for a query into buf.
+ * returns 0 on success, -1 on failure.
+ */
+static int rpc_cache_path(char *buf, size_t sz, enum aurquery_t type,
+						  const char *arg)
+{
+	struct stat st;
+
+	snprintf(buf, sz, "%s/%s", powaur_dir, PW_RPC_CACHE_DIR);
+	if (stat(buf, &st) && mkdir(buf, 0755) && errno != EEXIST) {
+		return -1;
+	}
+
+	/* The key line in the file guards against hash collisions */
+	snprintf(buf, sz, "%s/%s/%d-%08lx", powaur_dir, PW_RPC_CACHE_DIR,
+			 (int) type, sdbm(arg));
+	return 0;
+}
+
+char *rpc_cache_get(enum aurquery_t type, const char *arg, size_t *len)
+{
+	FILE *fp;
+	struct stat st;
+	char path[PATH_MAX];
+	char prefix[16];
+	char *data, *p;
+	size_t keylen, arglen;
+
+	if (!config->rpc_ttl || rpc_cache_path(path, PATH_MAX, type, arg)) {
+		return NULL;
+	}
+
+	if (stat(path, &st) || time(NULL) - st.st_mtime >= config->rpc_ttl) {
+		return NULL;
+	}
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		return NULL;
+	}
+
+	data = xcalloc(1, st.st_size + 1);
+	if (fread(data, 1, st.st_size, fp) != (size_t) st.st_size) {
+		goto miss;
+	}
+
+	/* First line is the type and argument */
+	snprintf(prefix, sizeof(prefix), "%d ", (int) type);
+	keylen = strlen(prefix);
+	arglen = strlen(arg);
+	if (strncmp(data, prefix, keylen) || strncmp(data + keylen, arg, arglen) ||
+		data[keylen + arglen] != '\n') {
+		goto miss;
+	}
+
+	p = data + keylen + arglen;
+	++p;
+	*len = st.st_size - (p - data);
+	memmove(data, p, *len + 1);
+	fclose(fp);
+
+	pw_printf(PW_LOG_DEBUG, "rpc cache: hit for %s\n", arg);
+	return data;
+
+miss:
+	free(data);
+	fclose(fp);
+	return NULL;
+}
+
+void rpc_cache_put(enum aurquery_t type, const char *arg, const char *data,
+				   size_t len)
+{
+	FILE *fp;
+	char path[PATH_MAX];
+	char tmppath[PATH_MAX];
+	int fd, ret;
+
+	if (!config->rpc_ttl || rpc_cache_path(path, PATH_MAX, type, arg)) {
+		return;
+	}
+
+	/* Write to a temporary file and rename, readers never see partial data */
+	snprintf(tmppath, PATH_MAX, "%s.XXXXXX", path);
+	fd = mkstemp(tmppath);
+	if (fd < 0) {
+		return;
+	}
+
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		close(fd);
+		unlink(tmppath);
+		return;
+	}
+
+	fprintf(fp, "%d %s\n", (int) type, arg);
+	fwrite(data, 1, len, fp);
+	ret = ferror(fp);
+
+	if (fclose(fp) || ret || rename(tmppath, path)) {
+		unlink(tmppath);
+		return;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	rpc_dirty = 1;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+struct cache_file {
+	char *name;
+	time_t mtime;
+	unsigned long size;
+};
+
+static int cache_file_mtime_cmp(const void *a, const void *b)
+{
+	const struct cache_file *x = a;
+	const struct cache_file *y = b;
+
+	if (x->mtime != y->mtime) {
+		return x->mtime < y->mtime ? -1 : 1;
+	}
+
+	return strcmp(x->name, y->name);
+}
+
+static int cache_file_name_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct cache_file *) a)->name,
+				  ((const struct cache_file *) b)->name);
+}
+
+/* Lists the entries of the cache.
+ * returns the number of entries, stored in *files, -1 on failure.
+ */
+static int cache_list(const char *dir, struct cache_file **files,
+					  unsigned long *total)
+{
+	DIR *dirp;
+	struct dirent *dirent;
+	struct stat st;
+	char path[PATH_MAX];
+	int cnt = 0, alloc = 0;
+
+	*files = NULL;
+	*total = 0;
+
+	dirp = opendir(dir);
+	if (!dirp) {
+		return -1;
+	}
+
+	while ((dirent = readdir(dirp))) {
+		/* Skip ., .. and partial downloads */
+		if (dirent->d_name[0] == '.' || is_meta(dirent->d_name)) {
+			continue;
+		}
+
+		snprintf(path, PATH_MAX, "%s/%s", dir, dirent->d_name);
+		if (stat(path, &st) || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+
+		if (cnt == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			*files = xrealloc(*files, alloc * sizeof(struct cache_file));
+		}
+
+		(*files)[cnt].name = xstrdup(dirent->d_name);
+		(*files)[cnt].mtime = st.st_mtime;
+		(*files)[cnt].size = st.st_size;
+
+		snprintf(path, PATH_MAX, "%s/%s%s", dir, dirent->d_name, CACHE_META_EXT);
+		if (!stat(path, &st)) {
+			(*files)[cnt].size += st.st_size;
+		}
+
+		*total += (*files)[cnt].size;
+		++cnt;
+	}
+
+	closedir(dirp);
+	return cnt;
+}
+
+static void cache_files_free(struct cache_file *files, int cnt)
+{
+	int i;
+	for (i = 0; i < cnt; ++i) {
+		free(files[i].name);
+	}
+
+	free(files);
+}
+
+int cache_prune(unsigned long maxsize)
+{
+	struct cache_file *files;
+	unsigned long total;
+	char dir[PATH_MAX];
+	char path[PATH_MAX];
+	int i, cnt, evicted = 0;
+
+	snprintf(dir, PATH_MAX, "%s/%s", powaur_dir, PW_CACHE_DIR);
+	cnt = cache_list(dir, &files, &total);
+	if (cnt <= 0) {
+		return 0;
+	}
+
+	/* Oldest first */
+	qsort(files, cnt, sizeof(struct cache_file), cache_file_mtime_cmp);
+
+	for (i = 0; i < cnt && total > maxsize; ++i) {
+		snprintf(path, PATH_MAX, "%s/%s", dir, files[i].name);
+		unlink(path);
+		snprintf(path, PATH_MAX, "%s/%s%s", dir, files[i].name, CACHE_META_EXT);
+		unlink(path);
+
+		total -= files[i].size;
+		++evicted;
+		pw_printf(PW_LOG_DEBUG, "cache: evicted %s\n", files[i].name);
+	}
+
+	cache_files_free(files, cnt);
+	return evicted;
+}
+
+int rpc_cache_prune(unsigned long maxage)
+{
+	struct cache_file *files;
+	unsigned long total;
+	char dir[PATH_MAX];
+	char path[PATH_MAX];
+	int i, cnt, expired = 0;
+	time_t now;
+
+	snprintf(dir, PATH_MAX, "%s/%s", powaur_dir, PW_RPC_CACHE_DIR);
+	cnt = cache_list(dir, &files, &total);
+	if (cnt <= 0) {
+		return 0;
+	}
+
+	/* Abandoned temporary files go the same way */
+	now = time(NULL);
+	for (i = 0; i < cnt; ++i) {
+		if ((unsigned long) (now - files[i].mtime) < maxage) {
+			continue;
+		}
+
+		snprintf(path, PATH_MAX, "%s/%s", dir, files[i].name);
+		if (!unlink(path)) {
+			++expired;
+		}
+	}
+
+	pw_printf(PW_LOG_DEBUG, "rpc cache: removed %d expired responses\n", expired);
+	cache_files_free(files, cnt);
+	return expired;
+}
+
+void cache_cleanup(void)
+{
+	if (cache_dirty && config->cachesize) {
+		cache_prune(config->cachesize);
+	}
+
+	if (rpc_dirty) {
+		rpc_cache_prune(config->rpc_ttl);
+	}
+}
+
+int powaur_cache(void)
+{
+	struct cache_file *files;
+	unsigned long total;
+	char dir[PATH_MAX];
+	int i, cnt;
+	time_t now;
+
+	if (config->op_c_clean) {
+		cnt = cache_prune(0);
+		printf("Removed %d cached %s\n", cnt, cnt == 1 ? "snapshot" : "snapshots");
+		cnt = rpc_cache_prune(config->rpc_ttl);
+		printf("Removed %d expired RPC %s\n", cnt, cnt == 1 ? "response" : "responses");
+
+		/* Sources fetched for builds, see build_levels */
+		snprintf(dir, PATH_MAX, "%s/%s", powaur_dir, PW_SRCDEST_DIR);
+		if (!access(dir, F_OK)) {
+			if (rmrf(dir)) {
+				pw_fprintf(PW_LOG_ERROR, stderr, "Unable to remove %s\n", dir);
+				return -1;
+			}
+
+			printf("Removed shared sources in %s\n", dir);
+		}
+
+		return 0;
+	}
+
+	snprintf(dir, PATH_MAX, "%s/%s", powaur_dir, PW_CACHE_DIR);
+	cnt = cache_list(dir, &files, &total);
+	if (cnt <= 0) {
+		printf("Cache %s is empty\n", dir);
+		return 0;
+	}
+
+	qsort(files, cnt, sizeof(struct cache_file), cache_file_name_cmp);
+	now = time(NULL);
+
+	for (i = 0; i < cnt; ++i) {
+		printf("%s%s%s %s%.1f KiB%s, used %ld min ago\n", color.bold,
+			   files[i].name, color.nocolor, color.bgreen,
+			   files[i].size / 1024.0, color.nocolor,
+			   (long) (now - files[i].mtime) / 60);
+	}
+
+	printf("\n%d %s, %.1f / %lu MiB in %s\n", cnt,
+		   cnt == 1 ? "snapshot" : "snapshots", total / (1024.0 * 1024.0),
+		   config->cachesize / (1024UL * 1024UL), dir);
+
+	cache_files_free(files, cnt);
+	return 0;
+}
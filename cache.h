@@ -0,0 +1,80 @@
+#ifndef POWAUR_CACHE_H
+#define POWAUR_CACHE_H
+
+#include <stdio.h>
+
+#include <curl/curl.h>
+
+#include "query.h"
+
+/* Local cache of AUR snapshots (tarballs and PKGBUILDs) in powaur_dir/cache.
+ *
+ * Each entry is stored under its name along with the ETag and Last-Modified
+ * headers it was served with, so that it can be revalidated with a
+ * conditional GET. The cache is capped at CacheSize MiB, least recently used
+ * entries are evicted first.
+ */
+
+/* Opaque */
+struct cache_entry;
+
+/* Opens the entry called name for a download.
+ * returns NULL if the cache is disabled.
+ */
+struct cache_entry *cache_entry_open(const char *name);
+
+/* Frees entry, discarding any uncommitted data */
+void cache_entry_close(struct cache_entry *entry);
+
+/* Sets the conditional request headers and header callback on curl.
+ * Must be called after curl_reset.
+ */
+void cache_entry_setopt(struct cache_entry *entry, CURL *curl);
+
+/* Stores data from a 200 response
+ * returns 0 on success, -1 on failure
+ */
+int cache_entry_write(struct cache_entry *entry, const void *ptr, size_t sz);
+
+/* Makes the written data the new cached copy */
+int cache_entry_commit(struct cache_entry *entry);
+
+/* Marks the cached copy as used after a 304.
+ * returns the path to the cached copy, NULL if there is none.
+ */
+const char *cache_entry_hit(struct cache_entry *entry);
+
+/* Evicts least recently used entries until the cache fits in maxsize bytes
+ * returns the number of entries evicted.
+ */
+int cache_prune(unsigned long maxsize);
+
+/* Enforces CacheSize if anything was added to the cache during this run, and
+ * drops expired RPC responses if any were stored
+ */
+void cache_cleanup(void);
+
+/* RPC response cache in powaur_dir/rpc.
+ * Raw responses are stored per (query type, argument) and reused for
+ * RpcCacheTTL seconds.
+ */
+
+/* returns the cached response for the query if it is fresh, NULL otherwise.
+ * The response is to be freed by the caller.
+ */
+char *rpc_cache_get(enum aurquery_t type, const char *arg, size_t *len);
+
+/* Stores the raw response of a query */
+void rpc_cache_put(enum aurquery_t type, const char *arg, const char *data,
+				   size_t len);
+
+/* Removes responses which are at least maxage seconds old.
+ * Done at exit if responses were stored during this run.
+ * returns the number of responses removed.
+ */
+int rpc_cache_prune(unsigned long maxage);
+
+/* --cache, lists or cleans the cache */
+int powaur_cache(void);
+
+#endif
@@ -21,6 +21,9 @@ struct config_t *config_init(void)
 	conf->op = PW_OP_MAIN;
 	conf->loglvl = PW_LOG_NORM | PW_LOG_INFO | PW_LOG_WARNING | PW_LOG_ERROR;
 	conf->color = 1;
+	conf->cachesize = PW_DEF_CACHESIZE * 1024UL * 1024UL;
+	conf->rpc_ttl = PW_DEF_RPC_TTL;
+	conf->buildjobs = PW_DEF_BUILDJOBS;
 	return conf;
 }
 
@@ -93,6 +96,46 @@ void parse_powaur_config(FILE *fp)
 				powaur_maxthreads = 0;
 			}
 
+		} else if (!strcmp(key, "BuildJobs")) {
+			if (config->opt_buildjobs) {
+				pw_printf(PW_LOG_DEBUG, "%s%s--jobs = %u, overriding config\n",
+						  TAB, TAB, config->buildjobs);
+				continue;
+			}
+
+			config->buildjobs = atoi(val);
+			if (config->buildjobs < 1 || config->buildjobs > PW_MAX_BUILDJOBS) {
+				config->buildjobs = PW_DEF_BUILDJOBS;
+			}
+
+			pw_printf(PW_LOG_DEBUG, "%s%sParsed BuildJobs = %u\n", TAB, TAB,
+					  config->buildjobs);
+
+		} else if (!strcmp(key, "AurUrl")) {
+			if (powaur_aur_url) {
+				free(powaur_aur_url);
+			}
+
+			/* Urls are built as AurUrl/path */
+			len = strlen(val);
+			while (len > 0 && val[len - 1] == '/') {
+				val[--len] = 0;
+			}
+
+			powaur_aur_url = xstrdup(val);
+			pw_printf(PW_LOG_DEBUG, "%s%sParsed AurUrl = %s\n", TAB, TAB,
+					  powaur_aur_url);
+
+		} else if (!strcmp(key, "CacheSize")) {
+			config->cachesize = strtoul(val, NULL, 10) * 1024UL * 1024UL;
+			pw_printf(PW_LOG_DEBUG, "%s%sParsed CacheSize = %lu MiB\n", TAB, TAB,
+					  config->cachesize / (1024UL * 1024UL));
+
+		} else if (!strcmp(key, "RpcCacheTTL")) {
+			config->rpc_ttl = strtoul(val, NULL, 10);
+			pw_printf(PW_LOG_DEBUG, "%s%sParsed RpcCacheTTL = %u\n", TAB, TAB,
+					  config->rpc_ttl);
+
 		} else if (!strcmp(key, "Color")) {
 			if (!strcmp(val, "Off") && config->color > 0) {
 				--config->color;
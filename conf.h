@@ -12,7 +12,13 @@ struct config_t {
 
 	char *target_dir;
 	unsigned short maxthreads;
+	/* Max no. of packages built at the same time */
+	unsigned short buildjobs;
 	unsigned short color;
+	/* Max size of the snapshot cache in bytes, 0 disables it */
+	unsigned long cachesize;
+	/* Seconds for which RPC responses are reused, 0 disables it */
+	unsigned int rpc_ttl;
 	alpm_handle_t *handle;
 
 	unsigned help           : 1;
@@ -31,10 +37,14 @@ struct config_t {
 	/* -G options */
 	unsigned op_g_resolve   : 1;
 
+	/* --cache options */
+	unsigned op_c_clean     : 1;
+
 	/* Misc */
 	unsigned sort_votes     : 1;
 	unsigned verbose        : 1;
 	unsigned opt_maxthreads : 1;
+	unsigned opt_buildjobs  : 1;
 	unsigned color_set      : 1;
 	unsigned nocolor_set    : 1;
 	unsigned noconfirm      : 1;
@@ -1,27 +1,167 @@
 #include <curl/curl.h>
+#include <pthread.h>
 
 #include "curl.h"
+#include "powaur.h"
 #include "util.h"
 
 static int initialized = 0;
 
+/* DNS cache and TLS sessions shared by every easy handle. libcurl does not
+ * support sharing the connection cache between threads, so connections are
+ * only reused by the handles of one thread, see curl_thread_multi.
+ */
+static CURLSH *curl_share = NULL;
+static pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+/* Per thread multi handle, which owns the connections of its transfers */
+static pthread_key_t multi_key;
+static int multi_key_created = 0;
+
+/* Connection reuse stats */
+static struct {
+	pthread_mutex_t lock;
+	long requests;
+	long connects;
+	double handshake_time;
+} curl_stats = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0.0 };
+
+static void share_lock(CURL *curl, curl_lock_data data,
+					   curl_lock_access access, void *userptr)
+{
+	pthread_mutex_lock(&share_locks[data]);
+}
+
+static void share_unlock(CURL *curl, curl_lock_data data, void *userptr)
+{
+	pthread_mutex_unlock(&share_locks[data]);
+}
+
+static void pool_init(void)
+{
+	int i;
+
+	curl_share = curl_share_init();
+	if (!curl_share) {
+		return;
+	}
+
+	for (i = 0; i < CURL_LOCK_DATA_LAST; ++i) {
+		pthread_mutex_init(&share_locks[i], NULL);
+	}
+
+	curl_share_setopt(curl_share, CURLSHOPT_LOCKFUNC, share_lock);
+	curl_share_setopt(curl_share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+	curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+/* pthread key destructor, runs when a thread with a multi handle exits */
+static void multi_free(void *multi)
+{
+	curl_multi_cleanup(multi);
+}
+
+static void pool_free(void)
+{
+	int i;
+
+	if (!curl_share) {
+		return;
+	}
+
+	/* Easy handles still attached on error paths keep the share, and its
+	 * locks, in use. Leave both alone then.
+	 */
+	if (curl_share_cleanup(curl_share) != CURLSHE_OK) {
+		pw_printf(PW_LOG_DEBUG, "curl: connection pool still in use\n");
+		return;
+	}
+
+	curl_share = NULL;
+
+	for (i = 0; i < CURL_LOCK_DATA_LAST; ++i) {
+		pthread_mutex_destroy(&share_locks[i]);
+	}
+}
+
 int curl_init(void)
 {
 	if (!initialized) {
 		curl_global_init(CURL_GLOBAL_ALL);
+		pool_init();
+		multi_key_created = !pthread_key_create(&multi_key, multi_free);
 		initialized = 1;
 	}
 
 	return !initialized;
 }
 
+static void curl_stats_print(void)
+{
+	double avg;
+	long reused;
+
+	if (!curl_stats.requests) {
+		return;
+	}
+
+	/* Each thread reuses its own connections, so this counts reuse within
+	 * threads, never across them
+	 */
+	reused = curl_stats.requests - curl_stats.connects;
+	avg = curl_stats.connects ? curl_stats.handshake_time / curl_stats.connects : 0.0;
+
+	pw_printf(PW_LOG_DEBUG, "curl: %ld requests, %ld new connections, "
+			  "%ld reused\n", curl_stats.requests, curl_stats.connects, reused);
+	pw_printf(PW_LOG_DEBUG, "curl: %.3fs spent in handshakes, ~%.3fs saved\n",
+			  curl_stats.handshake_time, avg * reused);
+}
+
 void curl_cleanup(void)
 {
+	CURLM *multi;
+
 	if (initialized) {
+		curl_stats_print();
+
+		/* Destructors do not run for the main thread */
+		if (multi_key_created) {
+			multi = pthread_getspecific(multi_key);
+			if (multi) {
+				curl_multi_cleanup(multi);
+				pthread_setspecific(multi_key, NULL);
+			}
+
+			pthread_key_delete(multi_key);
+			multi_key_created = 0;
+		}
+
+		pool_free();
 		curl_global_cleanup();
 	}
 }
 
+CURLM *curl_thread_multi(void)
+{
+	CURLM *multi;
+
+	if (!multi_key_created) {
+		return NULL;
+	}
+
+	multi = pthread_getspecific(multi_key);
+	if (!multi) {
+		multi = curl_multi_init();
+		if (multi && pthread_setspecific(multi_key, multi)) {
+			curl_multi_cleanup(multi);
+			multi = NULL;
+		}
+	}
+
+	return multi;
+}
+
 CURL *curl_easy_new(void)
 {
 	CURL *curl = curl_easy_init();
@@ -38,4 +178,29 @@ void curl_reset(CURL *curl)
 	curl_easy_reset(curl);
 	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
 	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+
+	if (curl_share) {
+		curl_easy_setopt(curl, CURLOPT_SHARE, curl_share);
+	}
+}
+
+void curl_stats_update(CURL *curl)
+{
+	long connects = 0;
+	double connect_time = 0.0, appconnect_time = 0.0;
+
+	curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+	if (connects) {
+		curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect_time);
+		curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &appconnect_time);
+	}
+
+	pthread_mutex_lock(&curl_stats.lock);
+	curl_stats.requests++;
+	curl_stats.connects += connects;
+	/* appconnect includes the tcp connect, and is 0 for plain http */
+	curl_stats.handshake_time += appconnect_time > connect_time ?
+		appconnect_time : connect_time;
+	pthread_mutex_unlock(&curl_stats.lock);
 }
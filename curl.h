@@ -6,6 +6,24 @@
 int curl_init(void);
 void curl_cleanup(void);
 CURL *curl_easy_new(void);
+
+/* Resets curl to our defaults.
+ * Every handle is attached to a shared pool, so DNS lookups and TLS sessions
+ * to the AUR are reused across handles and threads. Connections are not
+ * shared between threads.
+ */
 void curl_reset(CURL *curl);
 
+/* returns the multi handle of the calling thread, created on first use and
+ * freed when the thread exits. Transfers run through it reuse the
+ * connections of earlier ones on the same thread. NULL on failure.
+ */
+CURLM *curl_thread_multi(void);
+
+/* Records connection reuse stats for a completed transfer on curl.
+ * Reuse only happens within a thread.
+ * Shown with --debug.
+ */
+void curl_stats_update(CURL *curl);
+
 #endif
@@ -1,32 +1,125 @@
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
 
+#include <archive.h>
 #include <curl/curl.h>
 #include <pthread.h>
 
+#include "cache.h"
 #include "curl.h"
 #include "download.h"
 #include "error.h"
 #include "environment.h"
+#include "hash.h"
 #include "hashdb.h"
+#include "intern.h"
+#include "jobq.h"
+#include "package.h"
 #include "powaur.h"
 #include "util.h"
 #include "wrapper.h"
 
-/* For threaded downloads, points to targets */
-alpm_list_t *pw_jobq = NULL;
+/* A -G download job and its outcome */
+struct dl_job {
+	const char *pkgname;
+	int ret;
+};
+
+/* State shared by the -G workers */
+struct dl_pool {
+	struct jobq *jobq;
+
+	/* Used to resolve dependencies of extracted packages, NULL if not
+	 * resolving */
+	struct pw_hashdb *hashdb;
+
+	/* Guards seen and jobs */
+	pthread_mutex_t lock;
+	/* Maps package name to its job, so each package is queued once */
+	struct hashmap *seen;
+	alpm_list_t *jobs;
+};
+
+/* Destination of download_single_file */
+struct dl_file {
+	FILE *fp;
+	CURL *curl;
+	struct cache_entry *entry;
+	int checked;
+	long httpresp;
+};
+
+/* curl WRITEFUNCTION, tees a 200 response into the cache */
+static size_t file_write(void *ptr, size_t sz, size_t nmemb, void *userdata)
+{
+	struct dl_file *file = userdata;
+	size_t totalsz = sz * nmemb;
+
+	if (!file->checked) {
+		curl_easy_getinfo(file->curl, CURLINFO_RESPONSE_CODE, &file->httpresp);
+		file->checked = 1;
+	}
+
+	if (file->httpresp == 200) {
+		cache_entry_write(file->entry, ptr, totalsz);
+	}
+
+	return fwrite(ptr, 1, totalsz, file->fp);
+}
+
+/* Copies the cached copy at path into fp */
+static int copy_cached(const char *path, FILE *fp)
+{
+	FILE *in;
+	char buf[BUFSIZ];
+	size_t n;
+	int ret = 0;
+
+	in = fopen(path, "r");
+	if (!in) {
+		return -1;
+	}
+
+	while ((n = fread(buf, 1, BUFSIZ, in)) > 0) {
+		if (fwrite(buf, 1, n, fp) != n) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (ferror(in)) {
+		ret = -1;
+	}
+
+	fclose(in);
+	return ret;
+}
 
-int download_single_file(CURL *curl, const char *url, FILE *fp)
+int download_single_file(CURL *curl, const char *url, const char *cachekey,
+						 FILE *fp)
 {
 	int ret = 0;
 	long httpresp;
 	CURLcode curlret;
+	const char *cached = NULL;
+	struct dl_file file = {
+		fp, curl, NULL, 0, 0
+	};
+
+	if (cachekey) {
+		file.entry = cache_entry_open(cachekey);
+	}
 
 	curl_reset(curl);
 	curl_easy_setopt(curl, CURLOPT_URL, url);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, file_write);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &file);
+	cache_entry_setopt(file.entry, curl);
 
 	curlret = curl_easy_perform(curl);
+	curl_stats_update(curl);
 
 	if (curlret) {
 		pw_fprintf(PW_LOG_ERROR, stderr, "curl: %s\n",
@@ -36,16 +129,25 @@ int download_single_file(CURL *curl, const char *url, FILE *fp)
 	}
 
 	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpresp);
-	if (httpresp != 200) {
+	if (!ret && httpresp == 304) {
+		/* Not modified, use our copy */
+		cached = cache_entry_hit(file.entry);
+		if (!cached || copy_cached(cached, fp)) {
+			ret = -1;
+		}
+	} else if (httpresp != 200) {
 		pw_fprintf(PW_LOG_ERROR, stderr, "curl responded with http code: %ld\n",
 				  httpresp);
 		ret = -1;
+	} else if (!ret) {
+		cache_entry_commit(file.entry);
 	}
 
 	if (ret) {
 		pw_fprintf(PW_LOG_ERROR, stderr, "downloading %s failed.\n", url);
 	}
 
+	cache_entry_close(file.entry);
 	return ret;
 }
 
@@ -79,8 +181,8 @@ int download_single_package(CURL *curl, const char *pkgname,
 	}
 
 	/* Download the package */
-	snprintf(url, PATH_MAX, AUR_PKGTAR_URL, pkgname, pkgname);
-	ret = download_single_file(curl, url, fp);
+	snprintf(url, PATH_MAX, AUR_PKGTAR_URL, powaur_aur_url, pkgname, pkgname);
+	ret = download_single_file(curl, url, filename, fp);
 
 cleanup:
 	fclose(fp);
@@ -92,28 +194,309 @@ cleanup:
 	return ret;
 }
 
+/* A download being fed into libarchive as it arrives */
+struct dl_stream {
+	CURLM *multi;
+	CURL *curl;
+	const char *url;
+
+	/* Bytes received but not yet handed to libarchive */
+	char *buf;
+	size_t len;
+	size_t cap;
+
+	/* Bytes handed to libarchive, valid until its next read */
+	char *rbuf;
+	size_t rcap;
+
+	/* Snapshot cache entry, and our copy if the server says 304 */
+	struct cache_entry *entry;
+	FILE *cached;
+
+	int running;
+	int checked;
+	long httpresp;
+	CURLcode curlret;
+};
+
+/* curl WRITEFUNCTION, buffers data for stream_read */
+static size_t stream_write(void *ptr, size_t sz, size_t nmemb, void *userdata)
+{
+	struct dl_stream *stream = userdata;
+	size_t totalsz = sz * nmemb;
+
+	/* Bail out before feeding an error page to libarchive */
+	if (!stream->checked) {
+		curl_easy_getinfo(stream->curl, CURLINFO_RESPONSE_CODE, &stream->httpresp);
+		stream->checked = 1;
+	}
+
+	if (stream->httpresp == 304) {
+		return totalsz;
+	} else if (stream->httpresp != 200) {
+		return 0;
+	}
+
+	cache_entry_write(stream->entry, ptr, totalsz);
+
+	if (stream->len + totalsz > stream->cap) {
+		stream->cap = stream->len + totalsz > 2 * stream->cap ?
+			stream->len + totalsz : 2 * stream->cap;
+		stream->buf = xrealloc(stream->buf, stream->cap);
+	}
+
+	memcpy(stream->buf + stream->len, ptr, totalsz);
+	stream->len += totalsz;
+	return totalsz;
+}
+
+/* libarchive read callback, pumps curl until some data is available */
+static ssize_t stream_read(struct archive *archive, void *data, const void **out)
+{
+	struct dl_stream *stream = data;
+	CURLMsg *msg;
+	const char *path;
+	char *tmp;
+	size_t tmpcap;
+	int msgs;
+	ssize_t len;
+
+	while (!stream->len && stream->running) {
+		curl_multi_perform(stream->multi, &stream->running);
+		if (stream->len || !stream->running) {
+			break;
+		}
+
+		curl_multi_wait(stream->multi, NULL, 0, 1000, NULL);
+	}
+
+	while ((msg = curl_multi_info_read(stream->multi, &msgs))) {
+		if (msg->msg == CURLMSG_DONE) {
+			stream->curlret = msg->data.result;
+		}
+	}
+
+	if (!stream->len && !stream->running && !stream->cached) {
+		if (!stream->checked) {
+			curl_easy_getinfo(stream->curl, CURLINFO_RESPONSE_CODE,
+							  &stream->httpresp);
+			stream->checked = 1;
+		}
+
+		/* Not modified, extract our copy instead */
+		if (stream->curlret == CURLE_OK && stream->httpresp == 304) {
+			path = cache_entry_hit(stream->entry);
+			if (path) {
+				stream->cached = fopen(path, "r");
+			}
+		}
+	}
+
+	if (stream->cached) {
+		if (stream->rcap < BUFSIZ) {
+			stream->rcap = BUFSIZ;
+			stream->rbuf = xrealloc(stream->rbuf, stream->rcap);
+		}
+
+		len = fread(stream->rbuf, 1, stream->rcap, stream->cached);
+		if (ferror(stream->cached)) {
+			archive_set_error(archive, EIO, "reading cached %s failed", stream->url);
+			return -1;
+		}
+
+		*out = stream->rbuf;
+		return len;
+	}
+
+	if (!stream->len) {
+		if (stream->curlret != CURLE_OK || stream->httpresp != 200) {
+			archive_set_error(archive, EIO, "downloading %s failed", stream->url);
+			return -1;
+		}
+
+		return 0;
+	}
+
+	/* Hand over the received bytes and receive into the old buffer */
+	tmp = stream->rbuf;
+	tmpcap = stream->rcap;
+	stream->rbuf = stream->buf;
+	stream->rcap = stream->cap;
+	stream->buf = tmp;
+	stream->cap = tmpcap;
+
+	len = stream->len;
+	stream->len = 0;
+
+	*out = stream->rbuf;
+	return len;
+}
+
+/* Runs the transfer to its end once libarchive is done. libarchive stops at
+ * the end of archive marker, which may come before the gzip trailer or a
+ * transfer error.
+ */
+static void stream_finish(struct dl_stream *stream)
+{
+	CURLMsg *msg;
+	int msgs;
+
+	while (stream->running) {
+		/* What is left only goes to the cache */
+		stream->len = 0;
+		curl_multi_perform(stream->multi, &stream->running);
+		if (stream->running) {
+			curl_multi_wait(stream->multi, NULL, 0, 1000, NULL);
+		}
+	}
+
+	stream->len = 0;
+	while ((msg = curl_multi_info_read(stream->multi, &msgs))) {
+		if (msg->msg == CURLMSG_DONE) {
+			stream->curlret = msg->data.result;
+		}
+	}
+}
+
+/* Downloads url and extracts it into the current directory as data arrives.
+ * returns 0 on success, -1 on failure.
+ */
+static int stream_extract(CURL *curl, const char *url, const char *cachekey)
+{
+	struct dl_stream stream;
+	struct archive *archive;
+	int ret = 0;
+
+	memset(&stream, 0, sizeof(struct dl_stream));
+	stream.curl = curl;
+	stream.url = url;
+	stream.running = 1;
+	stream.entry = cache_entry_open(cachekey);
+
+	/* Kept for the thread, so the next download reuses the connection */
+	stream.multi = curl_thread_multi();
+	if (!stream.multi) {
+		cache_entry_close(stream.entry);
+		return error(PW_ERR_CURL_INIT);
+	}
+
+	archive = archive_reader_new();
+	if (!archive) {
+		cache_entry_close(stream.entry);
+		return error(PW_ERR_ARCHIVE_CREATE);
+	}
+
+	curl_reset(curl);
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, stream_write);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &stream);
+	cache_entry_setopt(stream.entry, curl);
+	curl_multi_add_handle(stream.multi, curl);
+
+	if (archive_read_open(archive, &stream, NULL, stream_read, NULL) != ARCHIVE_OK) {
+		pw_fprintf(PW_LOG_ERROR, stderr, "%s\n", archive_error_string(archive));
+		archive_read_finish(archive);
+		ret = -1;
+	} else if (extract_archive(archive)) {
+		ret = -1;
+	} else {
+		stream_finish(&stream);
+		if (stream.curlret != CURLE_OK) {
+			ret = -1;
+		}
+	}
+
+	curl_multi_remove_handle(stream.multi, curl);
+	curl_stats_update(curl);
+
+	/* Only keep complete archives which extracted fine. Failed cache
+	 * writes are caught by cache_entry_commit.
+	 */
+	if (!ret && stream.httpresp == 200) {
+		cache_entry_commit(stream.entry);
+	}
+
+	if (stream.checked && stream.httpresp != 200 && stream.httpresp != 304) {
+		pw_fprintf(PW_LOG_ERROR, stderr, "curl responded with http code: %ld\n",
+				   stream.httpresp);
+	} else if (stream.curlret != CURLE_OK) {
+		pw_fprintf(PW_LOG_ERROR, stderr, "curl: %s\n",
+				   curl_easy_strerror(stream.curlret));
+	}
+
+	if (ret) {
+		pw_fprintf(PW_LOG_ERROR, stderr, "downloading %s failed.\n", url);
+	}
+
+	if (stream.cached) {
+		fclose(stream.cached);
+	}
+
+	cache_entry_close(stream.entry);
+	free(stream.buf);
+	free(stream.rbuf);
+	return ret;
+}
+
 int dl_extract_single_package(CURL *curl, const char *pkgname,
 							  alpm_list_t **failed_packages, int verbose)
 {
-	int ret;
-	char filename[PATH_MAX];
+	int ret, existed;
+	struct stat st;
+	char url[PATH_MAX];
+	char cachekey[PATH_MAX];
 
-	snprintf(filename, PATH_MAX, "%s.tar.gz", pkgname);
-	ret = download_single_package(curl, pkgname, failed_packages, verbose);
+	/* The tarball is extracted as it downloads, only the cache keeps a copy */
+	snprintf(url, PATH_MAX, AUR_PKGTAR_URL, powaur_aur_url, pkgname, pkgname);
+	snprintf(cachekey, PATH_MAX, "%s.tar.gz", pkgname);
+	existed = !stat(pkgname, &st);
+	ret = stream_extract(curl, url, cachekey);
 
 	if (ret) {
-		unlink(filename);
-		return ret;
+		/* A partly extracted directory would pass for a downloaded package */
+		if (!existed && rmrf(pkgname)) {
+			pw_fprintf(PW_LOG_ERROR, stderr, "Unable to remove partly extracted %s\n",
+					   pkgname);
+		}
+
+		if (failed_packages) {
+			*failed_packages = alpm_list_add(*failed_packages, (void *) pkgname);
+		}
+	} else if (verbose) {
+		pw_printf(PW_LOG_INFO, "Downloaded %s.tar.gz\n", pkgname);
 	}
 
-	return extract_file(filename);
+	return ret;
 }
 
-static void *thread_dl_extract(void *useless)
+/* Queues pkgname unless it has been queued before */
+static void dl_pool_add(struct dl_pool *pool, const char *pkgname)
 {
-	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-	void *pkg;
-	int ret;
+	struct dl_job *job;
+
+	pthread_mutex_lock(&pool->lock);
+	if (hashmap_search(pool->seen, (void *) pkgname)) {
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+
+	job = xcalloc(1, sizeof(struct dl_job));
+	job->pkgname = intern(pkgname);
+	/* Jobs which never get to run count as failures */
+	job->ret = -1;
+
+	hashmap_insert(pool->seen, (void *) job->pkgname, job);
+	pool->jobs = alpm_list_add(pool->jobs, job);
+	pthread_mutex_unlock(&pool->lock);
+
+	jobq_push(pool->jobq, job);
+}
+
+static void *thread_dl_extract(void *data)
+{
+	struct dl_pool *pool = data;
+	struct dl_job *job;
+	alpm_list_t *i, *deps;
 
 	CURL *curl = curl_easy_new();
 	if (!curl) {
@@ -121,38 +504,68 @@ static void *thread_dl_extract(void *useless)
 		return NULL;
 	}
 
-	while (1) {
-		pthread_mutex_lock(&lock);
-		pkg = alpm_list_getdata(pw_jobq);
-		pw_jobq = alpm_list_next(pw_jobq);
-		pthread_mutex_unlock(&lock);
+	/* Keep going after failures, they are recorded in the job */
+	while ((job = jobq_pop(pool->jobq))) {
+		job->ret = dl_extract_single_package(curl, job->pkgname, NULL, 1);
+
+		/* Queue new AUR deps right away. This has to happen before the job
+		 * is marked done, or the queue may look drained to other workers. */
+		if (!job->ret && pool->hashdb) {
+			deps = resolve_pkg_dependencies(pool->hashdb, job->pkgname);
+			for (i = deps; i; i = i->next) {
+				pw_printf(PW_LOG_DEBUG, "%s depends on %s\n", job->pkgname, i->data);
+				dl_pool_add(pool, i->data);
+			}
 
-		if (!pkg) {
-			break;
+			FREELIST(deps);
 		}
 
-		ret = dl_extract_single_package(curl, pkg, NULL, 1);
-		if (ret) {
-			break;
-		}
+		jobq_done(pool->jobq);
 	}
 
 	curl_easy_cleanup(curl);
 	return NULL;
 }
 
-static void threadpool_dl_extract(alpm_list_t *targets)
+/* Downloads and extracts targets using up to MaxThreads threads.
+ * If hashdb is given, AUR dependencies of every extracted package are
+ * downloaded too, as soon as they are discovered.
+ * Packages which fail are strdup-ed into failed_packages.
+ *
+ * returns the number of failed packages.
+ */
+static int threadpool_dl_extract(alpm_list_t *targets, struct pw_hashdb *hashdb,
+								 alpm_list_t **failed_packages)
 {
 	pthread_attr_t attr;
 	pthread_t *threads;
+	struct dl_pool pool;
+	struct dl_job *job;
+	alpm_list_t *k;
 
 	int i, ret, num_threads;
-	void *placeholder;
+	int failed = 0;
+
+	if (!targets) {
+		return 0;
+	}
+
+	pool.jobq = jobq_new();
+	pool.hashdb = hashdb;
+	pool.seen = hashmap_new((pw_hash_fn) pw_strhash, intern_cmp);
+	pool.jobs = NULL;
+	pthread_mutex_init(&pool.lock, NULL);
 
-	num_threads = alpm_list_count(targets);
-	num_threads = num_threads > config->maxthreads ? config->maxthreads : num_threads;
+	for (k = targets; k; k = k->next) {
+		dl_pool_add(&pool, k->data);
+	}
 
-	pw_jobq = targets;
+	/* Dependencies may add more work later, so only cap by targets when
+	 * not resolving */
+	num_threads = config->maxthreads;
+	if (!hashdb && alpm_list_count(pool.jobs) < num_threads) {
+		num_threads = alpm_list_count(pool.jobs);
+	}
 
 	threads = xcalloc(num_threads, sizeof(pthread_t));
 	pthread_attr_init(&attr);
@@ -160,7 +573,7 @@ static void threadpool_dl_extract(alpm_list_t *targets)
 
 	pw_printf(PW_LOG_DEBUG, "Spawning %d threads.\n", num_threads);
 	for (i = 0; i < num_threads; ++i) {
-		ret = pthread_create(&threads[i], &attr, thread_dl_extract, placeholder);
+		ret = pthread_create(&threads[i], &attr, thread_dl_extract, &pool);
 		if (ret) {
 			die_errno(PW_ERR_PTHREAD_CREATE);
 		}
@@ -171,7 +584,7 @@ static void threadpool_dl_extract(alpm_list_t *targets)
 	pthread_attr_destroy(&attr);
 
 	for (i = 0; i < num_threads; ++i) {
-		ret = pthread_join(threads[i], &placeholder);
+		ret = pthread_join(threads[i], NULL);
 		if (ret) {
 			die_errno(PW_ERR_PTHREAD_JOIN);
 		}
@@ -179,7 +592,29 @@ static void threadpool_dl_extract(alpm_list_t *targets)
 		pw_printf(PW_LOG_DEBUG, "%d threads joined.\n", i+1);
 	}
 
+	for (k = pool.jobs; k; k = k->next) {
+		job = k->data;
+		if (job->ret) {
+			failed++;
+			if (failed_packages) {
+				*failed_packages = alpm_list_add(*failed_packages,
+												 xstrdup(job->pkgname));
+			}
+		}
+	}
+
+	if (hashdb) {
+		pw_printf(PW_LOG_DEBUG, "Downloaded %zu packages (%zu targets)\n",
+				  alpm_list_count(pool.jobs), alpm_list_count(targets));
+	}
+
+	pthread_mutex_destroy(&pool.lock);
+	hashmap_free(pool.seen);
+	alpm_list_free_inner(pool.jobs, (alpm_list_fn_free) free);
+	alpm_list_free(pool.jobs);
+	jobq_free(pool.jobq);
 	free(threads);
+	return failed;
 }
 
 /* Download pkgbuilds and extract in current directory.
@@ -188,13 +623,11 @@ int powaur_get(alpm_list_t *targets)
 {
 	int errors;
 	alpm_list_t *i, *failed_packages;
-	alpm_list_t *resolve, *new_resolve;
-	char filename[PATH_MAX];
+	struct pw_hashdb *hashdb;
 	char dirpath[PATH_MAX];
-	CURL *curl;
 
 	errors = 0;
-	failed_packages = resolve = new_resolve = NULL;
+	failed_packages = NULL;
 
 	if (!targets) {
 		return error(PW_ERR_TARGETS_NULL, "-G");
@@ -215,45 +648,30 @@ int powaur_get(alpm_list_t *targets)
 
 	pw_printf(PW_LOG_INFO, "Downloading files to %s\n", dirpath);
 
-	curl = curl_easy_new();
-	if (!curl) {
-		errors = 1;
-		goto cleanup;
-	}
-
 	if (!config->op_g_resolve) {
-		threadpool_dl_extract(targets);
+		errors += threadpool_dl_extract(targets, NULL, &failed_packages);
 		goto cleanup;
 	}
 
 	/* Threaded downloading w/ dependency resolution */
-	struct pw_hashdb *hashdb = build_hashdb();
+	hashdb = build_hashdb();
 	if (!hashdb) {
 		pw_fprintf(PW_LOG_ERROR, stderr, "Failed to build hash database!\n");
 		errors++;
 		goto cleanup;
 	}
-	resolve = alpm_list_strdup(targets);
 
-	while (resolve) {
-		threadpool_dl_extract(resolve);
-		new_resolve = resolve_dependencies(hashdb, resolve);
-		FREELIST(resolve);
-		resolve = new_resolve;
+	errors += threadpool_dl_extract(targets, hashdb, &failed_packages);
+	hashdb_free(hashdb);
 
-		if (config->loglvl & PW_LOG_DEBUG) {
-			pw_printf(PW_LOG_DEBUG, "Downloading the following deps:\n");
-			for (i = resolve; i; i = i->next) {
-				pw_printf(PW_LOG_DEBUG, "%s%s\n", TAB, i->data);
-			}
-			pw_printf(PW_LOG_DEBUG, "\n");
+cleanup:
+	if (failed_packages) {
+		pw_fprintf(PW_LOG_ERROR, stderr, "Failed to download the following packages:\n");
+		for (i = failed_packages; i; i = i->next) {
+			pw_fprintf(PW_LOG_ERROR, stderr, "%s%s\n", TAB, i->data);
 		}
 	}
 
-	hashdb_free(hashdb);
-
-cleanup:
-	alpm_list_free(failed_packages);
-	curl_easy_cleanup(curl);
+	FREELIST(failed_packages);
 	return errors ? -1 : 0;
 }
@@ -4,7 +4,14 @@
 #include <alpm_list.h>
 #include <curl/curl.h>
 
-int download_single_file(CURL *curl, const char *url, FILE *fp);
+/* Downloads url into fp.
+ * If cachekey is non-NULL, the download is revalidated against the snapshot
+ * cache entry of that name, and a 304 is served from the cached copy.
+ *
+ * returns 0 on success, -1 on failure.
+ */
+int download_single_file(CURL *curl, const char *url, const char *cachekey,
+						 FILE *fp);
 
 /* Downloads a single tarball from AUR.
  * Assumption: We are already in destination directory.
@@ -20,6 +27,7 @@ int download_single_package(CURL *curl, const char *pkgname,
 							alpm_list_t **failed_packages, int verbose);
 
 /* Downloads and extracts a single package.
+ * The tarball is extracted as it arrives, without a temporary file.
  * returns 0 on success, -1 on failure.
  *
  * @param curl curl handle
@@ -19,6 +19,7 @@ enum _pw_errno_t pwerrno = PW_ERR_OK;
 char *powaur_dir;
 char *powaur_editor;
 int powaur_maxthreads;
+char *powaur_aur_url;
 
 struct colorstrs color;
 
@@ -236,6 +237,10 @@ cleanup:
 				  TAB, powaur_editor);
 	}
 
+	if (!powaur_aur_url) {
+		powaur_aur_url = xstrdup(AUR_URL);
+	}
+
 	if (powaur_maxthreads <= 0 || powaur_maxthreads > PW_DEF_MAXTHREADS) {
 		powaur_maxthreads = PW_DEF_MAXTHREADS;
 	}
@@ -269,6 +274,7 @@ void cleanup_environment(void)
 	colors_cleanup();
 	free(powaur_editor);
 	free(powaur_dir);
+	free(powaur_aur_url);
 
 	/* No need to free pacman_cachedirs */
 	free(pacman_rootdir);
@@ -7,11 +7,17 @@
 #include "conf.h"
 #include "powaur.h"
 
+/* Default for AurUrl, the remaining urls are formatted with powaur_aur_url */
 #define AUR_URL          "http://aur.archlinux.org"
-#define AUR_PKG_URL      "http://aur.archlinux.org/packages.php?ID=%s"
-#define AUR_PKGTAR_URL   "http://aur.archlinux.org/packages/%s/%s.tar.gz"
-#define AUR_PKGBUILD_URL "http://aur.archlinux.org/packages/%s/PKGBUILD"
-#define AUR_RPC_URL      "http://aur.archlinux.org/rpc.php?type=%s&arg=%s"
+#define AUR_PKG_URL      "%s/packages.php?ID=%s"
+#define AUR_PKGTAR_URL   "%s/packages/%s/%s.tar.gz"
+#define AUR_PKGBUILD_URL "%s/packages/%s/PKGBUILD"
+#define AUR_RPC_URL      "%s/rpc.php?type=%s&arg=%s"
+#define AUR_RPC_MINFO_URL "%s/rpc.php?type=multiinfo"
+#define AUR_RPC_MINFO_ARG "&arg%5B%5D="
+
+/* Keep batched RPC requests below common URL length limits */
+#define AUR_RPC_MAX_URL_LEN 4000
 
 #define AUR_RPC_TYPE_INFO    "info"
 #define AUR_RPC_TYPE_MSEARCH "msearch"
@@ -22,6 +28,13 @@
 #define PW_DEF_EDITOR     "vim"
 #define PW_CONF           "powaur.conf"
 #define PW_DEF_MAXTHREADS 10
+#define PW_DEF_BUILDJOBS  1
+#define PW_MAX_BUILDJOBS  64
+#define PW_DEF_CACHESIZE  100
+#define PW_CACHE_DIR      "cache"
+#define PW_DEF_RPC_TTL    300
+#define PW_RPC_CACHE_DIR  "rpc"
+#define PW_SRCDEST_DIR    "sources"
 
 /* Pacman defaults */
 #define PACMAN_DEF_ROOTDIR  "/"
@@ -120,6 +133,7 @@ extern enum _pw_errno_t pwerrno;
 extern char *powaur_dir;
 extern char *powaur_editor;
 extern int powaur_maxthreads;
+extern char *powaur_aur_url;
 
 /* Pacman configuration settings */
 extern char *pacman_rootdir;
@@ -127,6 +141,7 @@ extern char *pacman_dbpath;
 extern alpm_list_t *pacman_cachedirs;
 extern alpm_list_t *pacman_syncdbs;
 
+int setup_config(void);
 int setup_environment(void);
 void colors_setup(void);
 void cleanup_environment(void);
@@ -64,8 +64,6 @@ const char *pw_strerror(enum _pw_errno_t err)
 		return "Failed to register alpm database";
 	case PW_ERR_INIT_ENV:
 		return "Setup environment failed";
-	case PW_ERR_INIT_HANDLE:
-		return "Handle initialization failed";
 	case PW_ERR_INIT_DIR:
 		return "Failed to setup powaur_dir";
 	case PW_ERR_INIT_LOCALDB:
@@ -1,94 +1,43 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "arena.h"
 #include "graph.h"
 #include "wrapper.h"
 #include "hash.h"
 
 #define GRAPH_INIT_VERTICES 40
-#define VINDEX_INIT_SZ 109
 #define STACK_INIT_SZ 40
+#define GRAPH_POOL_CHUNK 16384
 
 /* Debug output for dependency resolution */
 static int graph_debug_resolve = 0;
 
-/* Graph index data structures
- * Used internally inside struct graph
+/* An edge while the graph is being built. Edges are kept in order of
+ * addition so that traversals are deterministic.
  */
-
-struct vertex {
-	void *data;
-	int *adj;
-	unsigned int nr;
-	unsigned int sz;
-	int dfs_idx;
-
-	enum {
-		WHITE, GRAY, BLACK
-	} color;
+struct graph_edge {
+	int from;
+	int to;
+	struct graph_edge *next;
 };
 
-/* struct vertex functions */
-
-#define VERTEX_ADJ_INIT_SZ 20
-static void vertex_free(struct vertex *vertex)
-{
-	if (!vertex) {
-		return;
-	}
-
-	free(vertex->adj);
-}
-
-static void vertex_reset(struct vertex *vertex)
-{
-	vertex->data = NULL;
-	vertex->adj = NULL;
-	vertex->nr = 0;
-	vertex->sz = 0;
-	vertex->dfs_idx = 0;
-	vertex->color = WHITE;
-}
-
-static void vertex_init(struct vertex *vertex)
+static unsigned long graph_edge_hash(void *data)
 {
-	vertex_reset(vertex);
-	vertex->adj = xcalloc(VERTEX_ADJ_INIT_SZ, sizeof(int));
-	vertex->sz = VERTEX_ADJ_INIT_SZ;
+	struct graph_edge *edge = data;
+	return (unsigned long) edge->from * 2654435761UL ^ edge->to;
 }
 
-static void vertex_dfs_reset(struct vertex *vertex)
+static int graph_edge_cmp(const void *a, const void *b)
 {
-	vertex->color = WHITE;
-	vertex->dfs_idx = 0;
-}
-
-/* Add an edge to the vertex */
-static void vertex_add_edge(struct vertex *vertex, int edge)
-{
-	if (vertex->nr >= vertex->sz) {
-		unsigned int new_size = new_alloc_size(vertex->sz);
-		if (new_size <= vertex->sz) {
-			die("vertex_add_edge: adjacency list size exceeded");
-		}
+	const struct graph_edge *x = a;
+	const struct graph_edge *y = b;
 
-		vertex->adj = xrealloc(vertex->adj, new_size * sizeof(int));
-		vertex->sz = new_size;
+	if (x->from != y->from) {
+		return x->from - y->from;
 	}
 
-	unsigned int i;
-	for (i = 0; i < vertex->nr; ++i) {
-		if (edge == vertex->adj[i]) {
-			return;
-		}
-	}
-
-	vertex->adj[vertex->nr++] = edge;
-}
-
-static struct vertex *vertex_get_next_edge(struct graph *graph, struct vertex *vertex)
-{
-	return &(graph->vertices[vertex->adj[vertex->dfs_idx++]]);
+	return x->to - y->to;
 }
 
 /* Used to determine data is located in the graph's adj list
@@ -104,15 +53,12 @@ struct graph *graph_new(unsigned long (*hash_fn) (void *),
 {
 	struct graph *graph;
 	graph = xcalloc(1, sizeof(struct graph));
-	graph->nr = 0;
 	graph->sz = GRAPH_INIT_VERTICES;
-	graph->vertices = xcalloc(GRAPH_INIT_VERTICES, sizeof(struct vertex));
+	graph->data = xcalloc(GRAPH_INIT_VERTICES, sizeof(void *));
 	graph->vidx = hash_new(VINDEX, hash_fn, cmp_fn);
-
-	int i;
-	for (i = 0; i < GRAPH_INIT_VERTICES; ++i) {
-		vertex_reset(&graph->vertices[i]);
-	}
+	graph->edges = hash_new(HASH_TABLE, graph_edge_hash, graph_edge_cmp);
+	graph->pool = arena_new(GRAPH_POOL_CHUNK);
+	graph->edge_tail = &graph->edge_list;
 
 	return graph;
 }
@@ -123,23 +69,17 @@ void graph_free(struct graph *graph)
 		return;
 	}
 
-	int i;
-	for (i = 0; i < graph->nr; ++i) {
-		vertex_free(&graph->vertices[i]);
-	}
-
 	hash_free(graph->vidx);
-	free(graph->vertices);
+	hash_free(graph->edges);
+	arena_free(graph->pool);
+	free(graph->data);
+	free(graph->offsets);
+	free(graph->targets);
+	free(graph->rev_offsets);
+	free(graph->rev_targets);
 	free(graph);
 }
 
-static void graph_grow(struct graph *graph)
-{
-	unsigned int new_size = new_alloc_size(graph->sz);
-	graph->vertices = xrealloc(graph->vertices, new_size * sizeof(struct vertex));
-	graph->sz = new_size;
-}
-
 void graph_add_vertex(struct graph *graph, void *data)
 {
 	if (vindex_lookup(graph, data) != -1) {
@@ -147,11 +87,11 @@ void graph_add_vertex(struct graph *graph, void *data)
 	}
 
 	if (graph->nr >= graph->sz) {
-		graph_grow(graph);
+		graph->sz *= 2;
+		graph->data = xrealloc(graph->data, graph->sz * sizeof(void *));
 	}
 
-	vertex_init(&graph->vertices[graph->nr]);
-	graph->vertices[graph->nr].data = data;
+	graph->data[graph->nr] = data;
 
 	/* Required for vindex */
 	struct vidx_node node;
@@ -159,60 +99,187 @@ void graph_add_vertex(struct graph *graph, void *data)
 	node.idx = graph->nr;
 	hash_insert(graph->vidx, &node);
 	graph->nr++;
+	graph->dirty = 1;
 }
 
 void graph_add_edge(struct graph *graph, void *from, void *to)
 {
+	struct graph_edge edge, *edge_ptr;
+
 	/* Make sure both from and to actually exist, otherwise add */
 	graph_add_vertex(graph, from);
 	graph_add_vertex(graph, to);
 
-	int from_pos = vindex_lookup(graph, from);
-	int to_pos = vindex_lookup(graph, to);
+	edge.from = vindex_lookup(graph, from);
+	edge.to = vindex_lookup(graph, to);
+	edge.next = NULL;
+	if (hash_search(graph->edges, &edge)) {
+		return;
+	}
+
+	edge_ptr = arena_memdup(graph->pool, &edge, sizeof(struct graph_edge));
+	hash_insert(graph->edges, edge_ptr);
+	*graph->edge_tail = edge_ptr;
+	graph->edge_tail = &edge_ptr->next;
+	graph->nr_edges++;
+	graph->dirty = 1;
+}
+
+/* Lays the edges out in CSR form, reversed if reverse is set.
+ * The targets of vertex v are targets[offsets[v]] to targets[offsets[v+1]-1],
+ * in order of addition.
+ */
+static void graph_csr(struct graph *graph, int reverse, int **offsets, int **targets)
+{
+	struct graph_edge *edge;
+	int *next;
+	int i, from, to;
+
+	free(*offsets);
+	free(*targets);
+	*offsets = xcalloc(graph->nr + 1, sizeof(int));
+	*targets = xmalloc((graph->nr_edges ? graph->nr_edges : 1) * sizeof(int));
+
+	/* Count out degrees, then turn them into offsets */
+	for (edge = graph->edge_list; edge; edge = edge->next) {
+		from = reverse ? edge->to : edge->from;
+		(*offsets)[from + 1]++;
+	}
+
+	for (i = 0; i < graph->nr; ++i) {
+		(*offsets)[i + 1] += (*offsets)[i];
+	}
+
+	next = xmalloc((graph->nr ? graph->nr : 1) * sizeof(int));
+	memcpy(next, *offsets, graph->nr * sizeof(int));
+	for (edge = graph->edge_list; edge; edge = edge->next) {
+		from = reverse ? edge->to : edge->from;
+		to = reverse ? edge->from : edge->to;
+		(*targets)[next[from]++] = to;
+	}
+
+	free(next);
+}
+
+/* Rebuilds the CSR layouts if the graph changed since the last time */
+static void graph_freeze(struct graph *graph)
+{
+	if (!graph->dirty) {
+		return;
+	}
 
-	vertex_add_edge(&graph->vertices[from_pos], to_pos);
+	graph_csr(graph, 0, &graph->offsets, &graph->targets);
+	graph_csr(graph, 1, &graph->rev_offsets, &graph->rev_targets);
+	graph->dirty = 0;
 }
 
-/* returns 0 on no cycle, -1 on cycle */
-int graph_dfs(struct graph *graph, int root, struct stack *topost)
+/* Finds the strongly connected components of the graph with Tarjan's
+ * algorithm, without recursion. Roots and edges are taken in order of
+ * addition, so on an acyclic graph components complete in DFS postorder.
+ *
+ * @param comp set to the component of every vertex, indexed by vertex id.
+ *        Components are numbered in the order they complete, so edges only
+ *        go to components with a lower or equal number
+ * @param order set to every vertex, by order of completion of its component.
+ *        Members of a component are next to each other
+ * returns the number of components
+ */
+static int graph_tarjan(struct graph *graph, int *comp, int *order)
 {
-	graph->vertices[root].color = GRAY;
-	struct vertex *curv, *next;
-	struct stack *st = stack_new(sizeof(struct vertex *));
-	int ret = 0;
-	int pos;
-
-	curv = graph->vertices + root;
-	stack_push(st, &curv);
-	while (!stack_empty(st)) {
-		stack_peek(st, &curv);
-		if (curv->dfs_idx >= curv->nr) {
-			curv->color = BLACK;
-			pos = vindex_lookup(graph, curv->data);
-			stack_push(topost, &pos);
-			stack_pop(st, &curv);
+	int *index, *low, *dfs_idx, *callst, *sccst;
+	unsigned char *onst;
+	int depth, top, counter = 0, nr_comp = 0, nr_order = 0;
+	int root, v, w;
+
+	/* index 0 means not visited yet */
+	index = xcalloc(graph->nr + 1, sizeof(int));
+	low = xmalloc((graph->nr + 1) * sizeof(int));
+	onst = xcalloc(graph->nr + 1, sizeof(unsigned char));
+	callst = xmalloc((graph->nr + 1) * sizeof(int));
+	sccst = xmalloc((graph->nr + 1) * sizeof(int));
+	dfs_idx = xmalloc((graph->nr + 1) * sizeof(int));
+	memcpy(dfs_idx, graph->offsets, graph->nr * sizeof(int));
+
+	for (root = 0; root < graph->nr; ++root) {
+		if (index[root]) {
 			continue;
 		}
 
-		next = vertex_get_next_edge(graph, curv);
-		if (next->color == GRAY) {
-			ret = -1;
-			if (graph_debug_resolve) {
-				const char *visiting_pkg = curv->data;
-				const char *visited_pkg = next->data;
+		depth = top = 0;
+		index[root] = low[root] = ++counter;
+		sccst[top++] = root;
+		onst[root] = 1;
+		callst[depth++] = root;
+
+		while (depth) {
+			v = callst[depth - 1];
+			if (dfs_idx[v] < graph->offsets[v + 1]) {
+				w = graph->targets[dfs_idx[v]++];
+				if (!index[w]) {
+					index[w] = low[w] = ++counter;
+					sccst[top++] = w;
+					onst[w] = 1;
+					callst[depth++] = w;
+				} else if (onst[w] && index[w] < low[v]) {
+					low[v] = index[w];
+				}
+
+				continue;
+			}
+
+			/* Done with v, pass its low link up to its parent */
+			if (--depth && low[v] < low[callst[depth - 1]]) {
+				low[callst[depth - 1]] = low[v];
+			}
+
+			if (low[v] == index[v]) {
+				do {
+					w = sccst[--top];
+					onst[w] = 0;
+					comp[w] = nr_comp;
+					order[nr_order++] = w;
+				} while (w != v);
 
-				fprintf(stderr, "Cyclic dep with %s -> ... -> %s -> %s\n",
-						visited_pkg, visiting_pkg, visited_pkg);
+				nr_comp++;
 			}
-			break;
-		} else if (next->color == WHITE) {
-			next->color = GRAY;
-			stack_push(st, &next);
 		}
 	}
 
-	stack_free(st);
-	return ret;
+	free(index);
+	free(low);
+	free(onst);
+	free(callst);
+	free(sccst);
+	free(dfs_idx);
+	return nr_comp;
+}
+
+/* Returns non-zero if vertex v has an edge to itself */
+static int graph_self_edge(struct graph *graph, int v)
+{
+	int e;
+
+	for (e = graph->offsets[v]; e < graph->offsets[v + 1]; ++e) {
+		if (graph->targets[e] == v) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Prints the members of the cyclic component order[first] to order[last-1] */
+static void graph_print_cycle(struct graph *graph, int *order, int first, int last)
+{
+	int i;
+
+	fprintf(stderr, "Cyclic deps between ");
+	for (i = first; i < last; ++i) {
+		fprintf(stderr, "%s%s", i > first ? ", " : "",
+				(const char *) graph->data[order[i]]);
+	}
+
+	fprintf(stderr, "\n");
 }
 
 void *graph_get_vertex_data(struct graph *graph, int pos)
@@ -221,29 +288,157 @@ void *graph_get_vertex_data(struct graph *graph, int pos)
 		return NULL;
 	}
 
-	return graph->vertices[pos].data;
+	return graph->data[pos];
 }
 
 int graph_toposort(struct graph *graph, struct stack *topost)
 {
-	/* Reset color */
-	int i, cycle = 0;
-	for (i = 0; i < graph->nr; ++i) {
-		vertex_dfs_reset(graph->vertices + i);
-	}
+	int *comp, *order;
+	int i, first, cycle = 0;
+
+	graph_freeze(graph);
+
+	/* Per traversal state, indexed by vertex id */
+	comp = xmalloc((graph->nr + 1) * sizeof(int));
+	order = xmalloc((graph->nr + 1) * sizeof(int));
+	graph_tarjan(graph, comp, order);
+
+	/* Components complete in reverse topological order, which is what
+	 * topost holds. Members of a cyclic component stay together.
+	 */
+	for (first = i = 0; i < graph->nr; ++i) {
+		stack_push(topost, &order[i]);
+		if (i + 1 < graph->nr && comp[order[i + 1]] == comp[order[i]]) {
+			continue;
+		}
 
-	for (i = 0; i < graph->nr; ++i) {
-		if (graph->vertices[i].color == WHITE) {
-			cycle = graph_dfs(graph, i, topost);
-			if (cycle) {
-				break;
+		if (i > first || graph_self_edge(graph, order[i])) {
+			cycle = -1;
+			if (graph_debug_resolve) {
+				graph_print_cycle(graph, order, first, i + 1);
 			}
 		}
+
+		first = i + 1;
 	}
 
+	free(comp);
+	free(order);
 	return cycle;
 }
 
+int graph_scc(struct graph *graph, int **comp, unsigned char **cyclic)
+{
+	int *order;
+	int i, nr_comp;
+
+	graph_freeze(graph);
+	*comp = xmalloc((graph->nr + 1) * sizeof(int));
+	order = xmalloc((graph->nr + 1) * sizeof(int));
+	nr_comp = graph_tarjan(graph, *comp, order);
+
+	if (cyclic) {
+		*cyclic = xcalloc(nr_comp + 1, sizeof(unsigned char));
+		for (i = 0; i < graph->nr; ++i) {
+			if ((i && (*comp)[order[i]] == (*comp)[order[i - 1]]) ||
+				graph_self_edge(graph, order[i])) {
+				(*cyclic)[(*comp)[order[i]]] = 1;
+			}
+		}
+	}
+
+	free(order);
+	return nr_comp;
+}
+
+int graph_ancestors(struct graph *graph, int v, unsigned char *mark)
+{
+	int *st;
+	int e, u, top = 0, cnt = 0;
+
+	if (v < 0 || v >= graph->nr || mark[v]) {
+		return 0;
+	}
+
+	graph_freeze(graph);
+	st = xmalloc(graph->nr * sizeof(int));
+
+	/* Every vertex is pushed at most once */
+	mark[v] = 1;
+	st[top++] = v;
+	while (top) {
+		u = st[--top];
+		cnt++;
+		for (e = graph->rev_offsets[u]; e < graph->rev_offsets[u + 1]; ++e) {
+			if (!mark[graph->rev_targets[e]]) {
+				mark[graph->rev_targets[e]] = 1;
+				st[top++] = graph->rev_targets[e];
+			}
+		}
+	}
+
+	free(st);
+	return cnt;
+}
+
+int graph_levels(struct graph *graph, int **level)
+{
+	int *indeg, *queue;
+	int head, tail, i, v, e, nlevels = 0;
+
+	graph_freeze(graph);
+	*level = xcalloc(graph->nr + 1, sizeof(int));
+	indeg = xcalloc(graph->nr + 1, sizeof(int));
+	queue = xmalloc((graph->nr + 1) * sizeof(int));
+
+	for (e = 0; e < graph->nr_edges; ++e) {
+		indeg[graph->targets[e]]++;
+	}
+
+	head = tail = 0;
+	for (v = 0; v < graph->nr; ++v) {
+		if (!indeg[v]) {
+			queue[tail++] = v;
+		}
+	}
+
+	/* A vertex goes one level past the deepest vertex it has an edge from */
+	while (head < tail) {
+		v = queue[head++];
+		if ((*level)[v] >= nlevels) {
+			nlevels = (*level)[v] + 1;
+		}
+
+		for (e = graph->offsets[v]; e < graph->offsets[v + 1]; ++e) {
+			i = graph->targets[e];
+			if ((*level)[i] <= (*level)[v]) {
+				(*level)[i] = (*level)[v] + 1;
+			}
+
+			if (!--indeg[i]) {
+				queue[tail++] = i;
+			}
+		}
+	}
+
+	free(indeg);
+	free(queue);
+
+	/* Vertices on cycles never run out of incoming edges */
+	if (tail < graph->nr) {
+		free(*level);
+		*level = NULL;
+		return -1;
+	}
+
+	return nlevels;
+}
+
+int graph_vertex_id(struct graph *graph, void *data)
+{
+	return vindex_lookup(graph, data);
+}
+
 void graph_enable_debug_resolve(void)
 {
 	graph_debug_resolve = 1;
@@ -3,20 +3,40 @@
 
 #include "hash.h"
 
-/* Opaque */
-struct vertex;
-
-/* Forward declaration */
+/* Forward declarations */
+struct arena;
+struct graph_edge;
 struct stack;
 
 /* Graph data structure.
+ * Vertices are numbered in order of addition. Edges are collected with
+ * duplicates dropped, and laid out in compressed sparse row form when the
+ * graph is traversed, so traversals only deal with vertex ids.
+ *
  * vidx - hash table used to query index of a given vertex
+ * data - vertex data, indexed by vertex id
+ * edges - set of struct graph_edge, for dropping duplicate edges
+ * edge_list - edges in order of addition, allocated from pool
+ * offsets, targets - CSR layout, rebuilt when dirty
+ * rev_offsets, rev_targets - the same with every edge reversed
  */
 struct graph {
-	struct vertex *vertices;
 	struct hash_table *vidx;
+	void **data;
 	int nr;
 	int sz;
+
+	struct hash_table *edges;
+	struct graph_edge *edge_list;
+	struct graph_edge **edge_tail;
+	int nr_edges;
+	struct arena *pool;
+
+	int *offsets;
+	int *targets;
+	int *rev_offsets;
+	int *rev_targets;
+	int dirty;
 };
 
 struct graph *graph_new(unsigned long (*hash_fn) (void *),
@@ -36,6 +56,11 @@ void graph_add_edge(struct graph *graph, void *from, void *to);
 void *graph_get_vertex_data(struct graph *graph, int pos);
 
 /* Does a topological sort of the graph, with cycle detection.
+ * Cycles do not stop the sort. Every strongly connected component is
+ * treated as a single vertex, so topost always ends up with every vertex
+ * and the members of a cycle next to each other. With debug resolve on,
+ * the members of every cycle are printed.
+ *
  * returns -1 if cycles are detected, 0 otherwise.
  *
  * @param graph graph to perform toposort on
@@ -43,8 +68,46 @@ void *graph_get_vertex_data(struct graph *graph, int pos);
  */
 int graph_toposort(struct graph *graph, struct stack *topost);
 
+/* Finds the strongly connected components of the graph, in linear time.
+ *
+ * @param graph graph to analyze
+ * @param comp set to an array of the component of every vertex, indexed by
+ *        vertex id. Edges only go to components with a lower or equal
+ *        number. To be freed by the caller
+ * @param cyclic if not NULL, set to an array telling for every component
+ *        whether it is a cycle. To be freed by the caller
+ * returns the number of components
+ */
+int graph_scc(struct graph *graph, int **comp, unsigned char **cyclic);
+
+/* Marks every vertex with a path to v, v included.
+ *
+ * @param graph graph to walk
+ * @param v vertex id to start from
+ * @param mark array of graph->nr flags, indexed by vertex id. Vertices
+ *        which are already marked are not walked again, so marks of an
+ *        earlier call can be kept to get the union
+ * returns the number of vertices newly marked
+ */
+int graph_ancestors(struct graph *graph, int v, unsigned char *mark);
+
+/* Groups vertices into dependency levels with Kahn's algorithm.
+ * Vertices without incoming edges are in level 0, the rest are one level
+ * past the deepest vertex they have an edge from. There are no edges
+ * between vertices of the same level.
+ *
+ * @param graph graph to compute levels on
+ * @param level set to an array of the level of every vertex, indexed by
+ *        vertex id. To be freed by the caller, NULL on cycles
+ * returns the number of levels, -1 if cycles are detected.
+ */
+int graph_levels(struct graph *graph, int **level);
+
+/* Returns the id of the vertex with the given data, -1 if there is none */
+int graph_vertex_id(struct graph *graph, void *data);
+
 /* Enables debugging output for dependency resolution
- * Currently, shows what causes cyclic deps
+ * Currently, shows the packages involved in every cyclic dep
  */
 void graph_enable_debug_resolve(void);
 void graph_disable_debug_resolve(void);
@@ -1,940 +1,719 @@
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <alpm.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "hash.h"
+#include "util.h"
 #include "wrapper.h"
 
-/* Adapted from pacman */
-static const unsigned int prime_list[] =
-{
-	109,    227,    467,    953,     2029,   4349,   4703,
-	10273,  22447,  45481,  92203,   202409, 410857,
-	834181, 902483, 976369, 20000003
-};
-
-static int prime_list_sz = sizeof(prime_list) / sizeof(prime_list[0]);
-
-/* For use in bsearch function */
-static int uint_cmp(const void *a, const void *b)
-{
-	return *(const unsigned int *) a - *(const unsigned int *) b;
-}
-
-unsigned int new_alloc_size(unsigned int old_size)
-{
-	unsigned int *ptr;
-	unsigned int new_size;
-	ptr = bsearch(&old_size, prime_list, prime_list_sz, sizeof(unsigned int ), uint_cmp);
-
-	if (!ptr || ptr - prime_list + 1 >= prime_list_sz) {
-		new_size = (old_size + 16) * 3/2;
-	} else {
-		new_size = ptr[1];
-	}
-
-	return new_size;
-}
-
 /*******************************************************************************
  *
  * Internal use only
  *
  ******************************************************************************/
 
-/* BST node */
-struct hashbst_tree_node {
+/* hashmap pair */
+struct hashmap_pair {
+	void *key;
 	void *val;
-	struct hashbst_tree_node *left;
-	struct hashbst_tree_node *right;
 };
 
-/* Simple BST */
-struct hashbst_tree {
+/* Entry layouts, one per table type. Hashes are folded to 32 bits so that
+ * a VINDEX entry fits in 16 bytes on 64 bit machines.
+ */
+struct htable_entry {
 	void *key;
-	struct hashbst_tree_node *root;
+	uint32_t hash;
 };
 
-/* hashmap pair */
-struct hashmap_pair {
+struct vindex_entry {
 	void *key;
-	void *val;
+	uint32_t hash;
+	int idx;
 };
 
-struct hash_table_entry {
-	unsigned long hash;
-
-	union {
-		/* Normal hash table */
-		void *data;
-
-		/* vindex */
-		struct vidx_node vidx;
-
-		/* hash bst */
-		struct hashbst_tree tree;
-
-		/* hash map */
-		struct hashmap_pair pair;
-	} u;
+struct hmap_entry {
+	void *key;
+	void *val;
+	uint32_t hash;
 };
 
+/* Swiss table.
+ *
+ * Besides the array of entries, there is one control byte per slot. An empty
+ * slot has CTRL_EMPTY, a full slot has the low 7 bits of its hash. Lookups
+ * compare the control bytes of HASH_GROUP_WIDTH slots at a time and only look
+ * at entries whose control byte matches.
+ *
+ * sz is always a power of 2. The first HASH_GROUP_WIDTH control bytes are
+ * mirrored past the end so that a group can be loaded from any slot.
+ *
+ * Growing is incremental. The old arrays are kept around and every insert
+ * moves HASH_MIGRATE_STEP of their slots over, lookups check both. Slots
+ * below old_next have been moved already.
+ *
+ * table and old_table hold the entry layout of type, see hashcore.h
+ */
 struct hash_table {
-	struct hash_table_entry *table;
+	unsigned char *ctrl;
+	void *table;
 	unsigned long (*hash) (void *);
 	int (*cmp) (const void *, const void *);
 	unsigned int sz;
 	unsigned int nr;
 
-	struct hash_vtbl *vtbl;
+	/* Arrays being migrated from, NULL when not growing */
+	unsigned char *old_ctrl;
+	void *old_table;
+	unsigned int old_sz;
+	unsigned int old_nr;
+	unsigned int old_next;
+
 	enum hash_type type;
 };
 
-typedef void (*hash_free_fn) (struct hash_table *htable);
-typedef void (*hash_insert_fn) (struct hash_table *htable, void *data);
-typedef void * (*hash_search_fn) (struct hash_table *htable, void *data);
-typedef int (*hash_pos_fn) (struct hash_table *htable, void *data);
+#define HASH_INIT_SZ     128
+#define HASH_GROUP_WIDTH 16
+#define CTRL_EMPTY       0x80
 
-struct hash_vtbl {
-	hash_free_fn free;
-	hash_insert_fn insert;
-	hash_search_fn search;
-	hash_pos_fn pos;
-};
+/* Old slots moved per insert while growing. The new table has room for
+ * 7/8 * old_sz inserts before it fills up, which needs at least 2.
+ */
+#define HASH_MIGRATE_STEP 16
+
+/* Buckets in the probe length histogram, the last one is open ended */
+#define HASH_PROBE_HIST  4
+
+#define hash_fold(hash) ((uint32_t) ((uint64_t) (hash) ^ ((uint64_t) (hash) >> 32)))
+#define hash_h1(hash)   ((unsigned int) ((hash) >> 7))
+#define hash_h2(hash)   ((unsigned char) ((hash) & 0x7f))
+#define ctrl_full(c)    (!((c) & CTRL_EMPTY))
+
+/* Maximum number of entries before growing, keeps load factor at 7/8 */
+#define hash_capacity_of(sz)  ((sz) / 8 * 7)
+#define hash_capacity(htable) hash_capacity_of((htable)->sz)
 
 /*******************************************************************************
  *
- * Public functions
+ * Control byte groups
+ *
  ******************************************************************************/
 
-/* Forward declaration */
-static void hash_setup_htable(struct hash_table *htable);
-static void hash_setup_vindex(struct hash_table *htable);
-static void hash_setup_bst(struct hash_table *htable);
-static void hash_setup_hmap(struct hash_table *htable);
-
-struct hash_table *hash_new(enum hash_type type, pw_hash_fn hashfn,
-							pw_hashcmp_fn hashcmp)
-{
-	struct hash_table *htable = xcalloc(1, sizeof(struct hash_table));
-	htable->sz = prime_list[0];
-	htable->table = xcalloc(htable->sz, sizeof(struct hash_table_entry));
-	htable->nr = 0;
-	htable->hash = hashfn;
-	htable->cmp = hashcmp;
-	htable->type = type;
-
-	switch (type) {
-	case VINDEX:
-		hash_setup_vindex(htable);
-		break;
-	case HASH_BST:
-		hash_setup_bst(htable);
-		break;
-	case HASH_MAP:
-		hash_setup_hmap(htable);
-		break;
-	default:
-		/* Default to HASH_TABLE */
-		hash_setup_htable(htable);
-		break;
+/* returns a bitmask of the slots in the group whose control byte is h2 */
+static inline unsigned int group_match(const unsigned char *ctrl, unsigned char h2)
+{
+#ifdef __SSE2__
+	__m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) h2)));
+#else
+	unsigned int i, mask = 0;
+	for (i = 0; i < HASH_GROUP_WIDTH; ++i) {
+		if (ctrl[i] == h2) {
+			mask |= 1U << i;
+		}
 	}
-
-	return htable;
+	return mask;
+#endif
 }
 
-void hash_free(struct hash_table *htable)
+/* returns a bitmask of the empty slots in the group */
+static inline unsigned int group_match_empty(const unsigned char *ctrl)
 {
-	htable->vtbl->free(htable);
+#ifdef __SSE2__
+	/* Only CTRL_EMPTY has the top bit set */
+	__m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+	return _mm_movemask_epi8(group);
+#else
+	unsigned int i, mask = 0;
+	for (i = 0; i < HASH_GROUP_WIDTH; ++i) {
+		if (ctrl[i] == CTRL_EMPTY) {
+			mask |= 1U << i;
+		}
+	}
+	return mask;
+#endif
 }
 
-void hash_insert(struct hash_table *htable, void *data)
+static void hash_set_ctrl(struct hash_table *htable, unsigned int pos, unsigned char h2)
 {
-	htable->vtbl->insert(htable, data);
-}
-
-void *hash_search(struct hash_table *htable, void *data)
-{
-	return htable->vtbl->search(htable, data);
+	htable->ctrl[pos] = h2;
+	if (pos < HASH_GROUP_WIDTH) {
+		htable->ctrl[htable->sz + pos] = h2;
+	}
 }
 
-int hash_pos(struct hash_table *htable, void *data)
+static void hash_ctrl_alloc(struct hash_table *htable, unsigned int sz)
 {
-	return htable->vtbl->pos(htable, data);
+	htable->sz = sz;
+	htable->ctrl = xmalloc(sz + HASH_GROUP_WIDTH);
+	memset(htable->ctrl, CTRL_EMPTY, sz + HASH_GROUP_WIDTH);
 }
 
-alpm_list_t *hash_to_list(struct hash_table *htable)
+/* Returns the first empty slot along the probe sequence of hash */
+static unsigned int hash_find_slot(struct hash_table *htable, uint32_t hash)
 {
-	alpm_list_t *data_list = NULL;
-	if (htable->type != HASH_TABLE) {
-		return NULL;
-	}
+	unsigned int mask = htable->sz - 1;
+	unsigned int pos = hash_h1(hash) & mask;
+	unsigned int stride = 0;
+	unsigned int match;
 
-	unsigned int i;
-	struct hash_table_entry *array = htable->table;
-	for (i = 0; i < htable->sz; ++i) {
-		if (array[i].u.data) {
-			data_list = alpm_list_add(data_list, array[i].u.data);
+	for (;;) {
+		match = group_match_empty(htable->ctrl + pos);
+		if (match) {
+			return (pos + __builtin_ctz(match)) & mask;
 		}
-	}
 
-	return data_list;
+		stride += HASH_GROUP_WIDTH;
+		pos = (pos + stride) & mask;
+	}
 }
 
-void hash_walk(struct hash_table *htable, void (*fn) (void *))
+static void hash_old_free(struct hash_table *htable)
 {
-	unsigned int i;
-	struct hash_table_entry *array = htable->table;
-
-	for (i = 0; i < htable->sz; ++i) {
-		if (array[i].u.data) {
-			fn(array[i].u.data);
-		}
-	}
+	free(htable->old_ctrl);
+	free(htable->old_table);
+	htable->old_ctrl = NULL;
+	htable->old_table = NULL;
+	htable->old_sz = htable->old_nr = htable->old_next = 0;
 }
 
 /*******************************************************************************
  *
- * Normal hash table
+ * Specialized cores
  *
- *****************************************************************************/
-
-/* Forward declaration */
-static void hash_free_htable(struct hash_table *htable);
-static void hash_insert_htable(struct hash_table *htable, void *data);
-static void *hash_search_htable(struct hash_table *htable, void *data);
-static int hash_pos_htable(struct hash_table *htable, void *data);
-
-static struct hash_vtbl hash_vtbl_htable = {
-	hash_free_htable,
-	hash_insert_htable,
-	hash_search_htable,
-	hash_pos_htable
-};
+ ******************************************************************************/
 
-static void hash_setup_htable(struct hash_table *htable)
-{
-	htable->vtbl = &hash_vtbl_htable;
-}
+#define HC_PREFIX htable
+#define HC_ENTRY struct htable_entry
+#include "hashcore.h"
 
-static void hash_entry_insert_htable(unsigned long hash, struct hash_table *htable, void *data)
-{
-	unsigned int pos = hash % htable->sz;
-	struct hash_table_entry *array = htable->table;
+#define HC_PREFIX vindex
+#define HC_ENTRY struct vindex_entry
+#include "hashcore.h"
 
-	while (array[pos].u.data) {
-		if (array[pos].hash == hash) {
-			if (!htable->cmp(array[pos].u.data, data)) {
-				return;
-			}
-		}
+#define HC_PREFIX hmap
+#define HC_ENTRY struct hmap_entry
+#include "hashcore.h"
 
-		if (++pos >= htable->sz) {
-			pos = 0;
-		}
+/* returns the number of groups probed to find the entry in slot pos */
+static unsigned int hash_probe_len(struct hash_table *htable, uint32_t hash,
+								   unsigned int pos)
+{
+	unsigned int mask = htable->sz - 1;
+	unsigned int probe = hash_h1(hash) & mask;
+	unsigned int stride = 0;
+	unsigned int len = 1;
+
+	while (((pos - probe) & mask) >= HASH_GROUP_WIDTH) {
+		stride += HASH_GROUP_WIDTH;
+		probe = (probe + stride) & mask;
+		++len;
 	}
 
-	array[pos].hash = hash;
-	array[pos].u.data = data;
-	htable->nr++;
+	return len;
 }
 
-/* Returns pointer to data in hash table if it exists */
-static struct hash_table_entry *hash_entry_lookup_htable(unsigned long hash,
-											struct hash_table *htable, void *data)
+static uint32_t hash_slot_hash(struct hash_table *htable, unsigned int pos)
 {
-	unsigned int pos = hash % htable->sz;
-	struct hash_table_entry *array = htable->table;
-
-	while (array[pos].u.data) {
-		if (array[pos].hash == hash) {
-			if (!htable->cmp(array[pos].u.data, data)) {
-				break;
-			}
-		}
-
-		if (++pos >= htable->sz) {
-			pos = 0;
-		}
+	switch (htable->type) {
+	case VINDEX:
+		return vindex_slot_hash(htable, pos);
+	case HASH_MAP:
+		return hmap_slot_hash(htable, pos);
+	default:
+		return htable_slot_hash(htable, pos);
 	}
+}
 
-	return array + pos;
+static int uint32_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+	return x < y ? -1 : x > y;
 }
 
-/* Grows a hash table based on prime_list
- * returns 0 on success, -1 on failure.
+/* Prints the load factor, probe length histogram and number of full hash
+ * collisions of a table. A collision costs an extra cmp on lookup.
  */
-static int hash_grow_htable(struct hash_table *htable)
+static void hash_stats_print(struct hash_table *htable, const char *name,
+							 enum pwloglevel_t lvl)
 {
-	unsigned int new_size;
-	new_size = new_alloc_size(htable->sz);
+	unsigned int i, len, nr = 0, collisions = 0;
+	unsigned int hist[HASH_PROBE_HIST] = {0};
+	unsigned long total = 0;
+	uint32_t *hashes;
 
-	if (new_size <= htable->sz) {
-		return -1;
+	if (!htable->nr) {
+		pw_printf(lvl, "hash: %s: empty, %u slots\n", name, htable->sz);
+		return;
 	}
 
-	/* Rehash */
-	struct hash_table_entry *old_table = htable->table;
-	unsigned int i;
-	unsigned int old_sz = htable->sz;
-	unsigned long hash;
-
-	htable->table = xcalloc(new_size, sizeof(struct hash_table_entry));
-	htable->sz = new_size;
-	htable->nr = 0;
-
-	for (i = 0; i < old_sz; ++i) {
-		if (old_table[i].u.data) {
-			hash = htable->hash(old_table[i].u.data);
-			hash_entry_insert_htable(hash, htable, old_table[i].u.data);
+	/* Probe lengths are for the current arrays only */
+	hashes = xcalloc(htable->nr, sizeof(uint32_t));
+	for (i = 0; i < htable->sz; ++i) {
+		if (!ctrl_full(htable->ctrl[i])) {
+			continue;
 		}
-	}
 
-	free(old_table);
-	return 0;
-}
+		hashes[nr] = hash_slot_hash(htable, i);
+		len = hash_probe_len(htable, hashes[nr], i);
+		total += len;
+		hist[len < HASH_PROBE_HIST ? len - 1 : HASH_PROBE_HIST - 1]++;
+		++nr;
+	}
 
-static void hash_free_htable(struct hash_table *htable)
-{
-	if (!htable) {
+	if (!nr) {
+		free(hashes);
+		pw_printf(lvl, "hash: %s: %u entries waiting to migrate\n", name, htable->old_nr);
 		return;
 	}
 
-	free(htable->table);
-	free(htable);
-}
-
-void hash_insert_htable(struct hash_table *htable, void *data)
-{
-	/* Maintain load factor of 1/2 */
-	if (htable->nr >= htable->sz / 2) {
-		if (hash_grow_htable(htable)) {
-			return;
+	qsort(hashes, nr, sizeof(uint32_t), uint32_cmp);
+	for (i = 1; i < nr; ++i) {
+		if (hashes[i] == hashes[i - 1]) {
+			++collisions;
 		}
 	}
+	free(hashes);
 
-	unsigned long hash = htable->hash(data);
-	struct hash_table_entry *entry = hash_entry_lookup_htable(hash, htable, data);
-	if (!entry->u.data) {
-		entry->hash = hash;
-		entry->u.data = data;
-		htable->nr++;
+	pw_printf(lvl, "hash: %s: %u entries, %u slots, load %.2f\n",
+			  name, htable->nr, htable->sz, (double) htable->nr / htable->sz);
+	pw_printf(lvl, "hash: %s: probe groups 1:%u 2:%u 3:%u %d+:%u, "
+			  "%.2f average\n", name, hist[0], hist[1], hist[2], HASH_PROBE_HIST,
+			  hist[3], (double) total / nr);
+	pw_printf(lvl, "hash: %s: %u full hash collisions, %.3f cmp per hit\n",
+			  name, collisions, 1.0 + (double) collisions / nr);
+	if (htable->old_table) {
+		pw_printf(lvl, "hash: %s: %u entries waiting to migrate\n", name, htable->old_nr);
 	}
 }
 
-void *hash_search_htable(struct hash_table *htable, void *data)
-{
-	struct hash_table_entry *entry;
-	unsigned long hash = htable->hash(data);
-
-	entry = hash_entry_lookup_htable(hash, htable, data);
-	return entry->u.data ? entry->u.data : NULL;
-}
+/*******************************************************************************
+ *
+ * Public functions
+ ******************************************************************************/
 
-int hash_pos_htable(struct hash_table *htable, void *data)
+struct hash_table *hash_new(enum hash_type type, pw_hash_fn hashfn,
+							pw_hashcmp_fn hashcmp)
 {
-	struct hash_table_entry *entry;
-	unsigned long hash = htable->hash(data);
-	entry = hash_entry_lookup_htable(hash, htable, data);
+	struct hash_table *htable = xcalloc(1, sizeof(struct hash_table));
+	htable->nr = 0;
+	htable->hash = hashfn;
+	htable->cmp = hashcmp;
 
-	if (entry->u.data) {
-		return entry - htable->table;
+	switch (type) {
+	case VINDEX:
+		vindex_alloc(htable, HASH_INIT_SZ);
+		break;
+	case HASH_MAP:
+		hmap_alloc(htable, HASH_INIT_SZ);
+		break;
+	default:
+		/* Default to HASH_TABLE */
+		type = HASH_TABLE;
+		htable_alloc(htable, HASH_INIT_SZ);
+		break;
 	}
 
-	return -1;
+	htable->type = type;
+	return htable;
 }
 
-/******************************************************************************
- *
- * VINDEX
- *
- *****************************************************************************/
-
-/* Forward declaration */
-static void hash_insert_vindex(struct hash_table *htable, void *data);
-static void *hash_search_vindex(struct hash_table *htable, void *data);
-static int hash_pos_vindex(struct hash_table *htable, void *data);
-
-static struct hash_vtbl hash_vtbl_vindex = {
-	/* NOTE: Sharing function with htable */
-	hash_free_htable,
-	hash_insert_vindex,
-	hash_search_vindex,
-	hash_pos_vindex
-};
-
-static void hash_setup_vindex(struct hash_table *htable)
+void hash_free(struct hash_table *htable)
 {
-	htable->vtbl = &hash_vtbl_vindex;
+	if (!htable) {
+		return;
+	}
+
+	free(htable->ctrl);
+	free(htable->table);
+	free(htable->old_ctrl);
+	free(htable->old_table);
+	free(htable);
 }
 
-static void hash_entry_insert_vindex(unsigned long hash, struct hash_table *htable,
-									 void *data, int idx)
+/* @param data the data for HASH_TABLE, a struct vidx_node * for VINDEX,
+ * a struct hashmap_pair * for HASH_MAP
+ */
+void hash_insert(struct hash_table *htable, void *data)
 {
-	unsigned int pos = hash % htable->sz;
-	struct hash_table_entry *table = htable->table;
+	struct vindex_entry *ventry;
+	struct hmap_entry *mentry;
+	struct vidx_node *node;
+	struct hashmap_pair *pair;
+	uint32_t hash;
 
-	while (table[pos].u.vidx.data) {
-		if (table[pos].hash == hash && !htable->cmp(table[pos].u.vidx.data, data)) {
+	switch (htable->type) {
+	case VINDEX:
+		node = data;
+		hash = hash_fold(htable->hash(node->data));
+		if (vindex_find(htable, hash, node->data)) {
 			return;
 		}
 
-		if (++pos >= htable->sz) {
-			pos = 0;
+		ventry = vindex_claim(htable, hash, node->data);
+		if (ventry) {
+			ventry->idx = node->idx;
+		}
+		break;
+	case HASH_MAP:
+		pair = data;
+		hash = hash_fold(htable->hash(pair->key));
+		if (hmap_find(htable, hash, pair->key)) {
+			return;
 		}
-	}
 
-	table[pos].hash = hash;
-	table[pos].u.vidx.data = data;
-	table[pos].u.vidx.idx = idx;
-	htable->nr++;
+		mentry = hmap_claim(htable, hash, pair->key);
+		if (mentry) {
+			mentry->val = pair->val;
+		}
+		break;
+	default:
+		hash = hash_fold(htable->hash(data));
+		if (!htable_find(htable, hash, data)) {
+			htable_claim(htable, hash, data);
+		}
+		break;
+	}
 }
 
-/* Returns pointer to data in hash table if it exists */
-static struct hash_table_entry *hash_entry_lookup_vindex(unsigned long hash,
-		struct hash_table *htable, void *data)
+/* returns the data for HASH_TABLE and VINDEX, the value for HASH_MAP */
+void *hash_search(struct hash_table *htable, void *data)
 {
-	unsigned int pos = hash % htable->sz;
-	struct hash_table_entry *array = htable->table;
-
-	while (array[pos].u.vidx.data) {
-		if (array[pos].hash == hash) {
-			if (!htable->cmp(array[pos].u.vidx.data, data)) {
-				break;
-			}
-		}
+	uint32_t hash = hash_fold(htable->hash(data));
+	struct vindex_entry *ventry;
+	struct hmap_entry *mentry;
+	struct htable_entry *entry;
 
-		if (++pos >= htable->sz) {
-			pos = 0;
-		}
+	switch (htable->type) {
+	case VINDEX:
+		ventry = vindex_find(htable, hash, data);
+		return ventry ? ventry->key : NULL;
+	case HASH_MAP:
+		mentry = hmap_find(htable, hash, data);
+		return mentry ? mentry->val : NULL;
+	default:
+		entry = htable_find(htable, hash, data);
+		return entry ? entry->key : NULL;
 	}
-
-	return array + pos;
 }
 
-/* Grows a hash table based on prime_list
- * returns 0 on success, -1 on failure.
+/* For VINDEX, this does NOT return where the data is in the hash table.
+ * It returns where the data is in the adjacency list of the graph, which is
+ * given by the idx of its entry.
  */
-static int hash_grow_vindex(struct hash_table *htable)
+int hash_pos(struct hash_table *htable, void *data)
 {
-	unsigned int new_size = new_alloc_size(htable->sz);
-	if (new_size <= htable->sz) {
-		return -1;
-	}
-
-	/* Rehash */
-	struct hash_table_entry *old_table = htable->table;
-	unsigned int i;
-	unsigned int old_size = htable->sz;
-	unsigned long hash;
+	uint32_t hash = hash_fold(htable->hash(data));
+	struct vindex_entry *ventry;
+	struct hmap_entry *mentry;
+	struct htable_entry *entry;
 
-	htable->table = xcalloc(new_size, sizeof(struct hash_table_entry));
-	htable->sz = new_size;
-	htable->nr = 0;
-
-	for (i = 0; i < old_size; ++i) {
-		if (old_table[i].u.vidx.data) {
-			hash_entry_insert_vindex(old_table[i].hash, htable, old_table[i].u.data,
-									 old_table[i].u.vidx.idx);
-		}
+	switch (htable->type) {
+	case VINDEX:
+		ventry = vindex_find(htable, hash, data);
+		return ventry ? ventry->idx : -1;
+	case HASH_MAP:
+		mentry = hmap_find(htable, hash, data);
+		return mentry ? hmap_index(htable, mentry) : -1;
+	default:
+		entry = htable_find(htable, hash, data);
+		return entry ? htable_index(htable, entry) : -1;
 	}
-
-	free(old_table);
-	return 0;
 }
 
-/* @param data a struct vidx_node * */
-void hash_insert_vindex(struct hash_table *htable, void *data)
+alpm_list_t *hash_to_list(struct hash_table *htable)
 {
-	/* Maintain load factor of 1/2 */
-	if (htable->nr >= htable->sz / 2) {
-		if (hash_grow_vindex(htable)) {
-			return;
-		}
+	alpm_list_t *data_list = NULL;
+	if (htable->type != HASH_TABLE) {
+		return NULL;
 	}
 
-	struct vidx_node *node = data;
-	unsigned long hash = htable->hash(node->data);
-	struct hash_table_entry *entry = hash_entry_lookup_vindex(hash, htable, node->data);
-	if (!entry->u.vidx.data) {
-		entry->hash = hash;
-		entry->u.vidx.data = node->data;
-		entry->u.vidx.idx = node->idx;
-		htable->nr++;
+	unsigned int it = 0;
+	struct htable_entry *entry;
+	while ((entry = htable_next(htable, &it))) {
+		data_list = alpm_list_add(data_list, entry->key);
 	}
-}
 
-void *hash_search_vindex(struct hash_table *htable, void *data)
-{
-	struct hash_table_entry *entry;
-	unsigned long hash = htable->hash(data);
-
-	entry = hash_entry_lookup_vindex(hash, htable, data);
-	return entry->u.vidx.data ? entry->u.vidx.data : NULL;
+	return data_list;
 }
 
-/* This does NOT return where the data is in the hash table.
- * It returns where the data is in the adjacency list of the graph, which is
- * given by the idx field in entry->u.vidx
- */
-int hash_pos_vindex(struct hash_table *htable, void *data)
+void hash_walk(struct hash_table *htable, void (*fn) (void *))
 {
-	struct hash_table_entry *entry;
-	unsigned long hash = htable->hash(data);
-	entry = hash_entry_lookup_vindex(hash, htable, data);
+	unsigned int it = 0;
+	struct htable_entry *entry;
 
-	if (entry->u.vidx.data) {
-		return entry->u.vidx.idx;
+	if (htable->type != HASH_TABLE) {
+		return;
 	}
 
-	return -1;
+	while ((entry = htable_next(htable, &it))) {
+		fn(entry->key);
+	}
 }
-/*******************************************************************************
- *
- * BST specific functions
- *
- ******************************************************************************/
 
-static void hashbst_tree_node_free(struct hashbst_tree_node *node)
+void hash_stats(struct hash_table *htable, const char *name, enum pwloglevel_t lvl)
 {
-	if (!node) {
-		return;
-	}
-
-	/* Recursion */
-	hashbst_tree_node_free(node->left);
-	hashbst_tree_node_free(node->right);
-	free(node);
+	hash_stats_print(htable, name, lvl);
 }
 
-/* Recursion */
-static void *hashbst_tree_node_search(struct hashbst_tree_node *node, void *search,
-									  hbst_search_fn fn)
+void hash_merge(struct hash_table *dst, struct hash_table *src)
 {
-	if (!node) {
-		return NULL;
-	}
+	unsigned int it = 0;
+	struct htable_entry *entry;
 
-	void *ret;
-	ret = hashbst_tree_node_search(node->left, search, fn);
-	if (ret) {
-		return ret;
+	if (dst->type != HASH_TABLE || src->type != HASH_TABLE) {
+		return;
 	}
 
-	ret = fn(search, node->val);
-	if (ret) {
-		return ret;
-	}
+	while ((entry = htable_next(src, &it))) {
+		if (htable_find(dst, entry->hash, entry->key)) {
+			continue;
+		}
 
-	return hashbst_tree_node_search(node->right, search, fn);
+		if (!htable_claim(dst, entry->hash, entry->key)) {
+			return;
+		}
+	}
 }
 
-/* Inserts a value into the bst, based on cmp */
-static void hashbst_bst_insert(struct hashbst_tree *bst, void *data, pw_hashcmp_fn cmp)
+void hash_reserve(struct hash_table *htable, unsigned int nr)
 {
-	if (!bst->root) {
-		bst->root = xcalloc(1, sizeof(struct hashbst_tree_node));
-		bst->root->val = data;
-		return;
-	}
-
-	int res, is_left_child = 1;
-	struct hashbst_tree_node *parent, *cur;
-	cur = bst->root;
-
-	while (cur) {
-		parent = cur;
-		res = cmp(data, cur->val);
+	unsigned int new_size = htable->sz;
 
-		if (res == 0) {
-			/* No duplicates */
+	while (hash_capacity_of(new_size) < nr) {
+		if (new_size * 2 <= new_size) {
 			return;
-		} else if (res < 0) {
-			cur = cur->left;
-			is_left_child = 1;
-		} else {
-			cur = cur->right;
-			is_left_child = 0;
 		}
+		new_size *= 2;
 	}
 
-	if (is_left_child) {
-		parent->left = xcalloc(1, sizeof(struct hashbst_tree_node));
-		parent->left->val = data;
-	} else {
-		parent->right = xcalloc(1, sizeof(struct hashbst_tree_node));
-		parent->right->val = data;
+	if (new_size <= htable->sz) {
+		return;
 	}
-}
 
-/* Frees an entire tree */
-static void hashbst_bst_free(struct hashbst_tree *bst)
-{
-	hashbst_tree_node_free(bst->root);
+	switch (htable->type) {
+	case VINDEX:
+		vindex_rehash(htable, new_size);
+		break;
+	case HASH_MAP:
+		hmap_rehash(htable, new_size);
+		break;
+	default:
+		htable_rehash(htable, new_size);
+		break;
+	}
 }
 
 /*******************************************************************************
  *
- * Hash BST - Wrapper over HASH_BST hash tables
+ * CSR map - Wrapper over VINDEX
+ *
+ * Pairs are staged with csrmap_add and laid out by csrmap_build. Each key
+ * maps to a row, and the values of row r are vals[offsets[r]] up to
+ * vals[offsets[r + 1]], sorted by valcmp without duplicates.
  *
  ******************************************************************************/
 
-struct hashbst {
-	struct hash_table *htable;
-};
-
-/* Use this to insert into the underlying hash table */
-struct hashbst_pair {
+struct csrmap_pair {
 	void *key;
 	void *val;
 };
 
-struct hashbst *hashbst_new(pw_hash_fn hashfn, pw_hashcmp_fn hashcmp)
-{
-	struct hashbst *hbst = xcalloc(1, sizeof(struct hashbst));
-	hbst->htable = hash_new(HASH_BST, hashfn, hashcmp);
-	return hbst;
-}
+struct csrmap {
+	/* key -> row */
+	struct hash_table *rows;
+	pw_hashcmp_fn valcmp;
+
+	/* Staged pairs */
+	struct csrmap_pair *pairs;
+	unsigned int nr_pairs;
+	unsigned int max_pairs;
+
+	unsigned int nr_rows;
+	unsigned int max_rows;
+	void **keys;
+	unsigned int *offsets;
+	void **vals;
+};
 
-void hashbst_free(struct hashbst *hbst)
+struct csrmap *csrmap_new(pw_hash_fn hashfn, pw_hashcmp_fn keycmp,
+						  pw_hashcmp_fn valcmp)
 {
-	hash_free(hbst->htable);
-	free(hbst);
+	struct csrmap *csr = xcalloc(1, sizeof(struct csrmap));
+	csr->rows = hash_new(VINDEX, hashfn, keycmp);
+	csr->valcmp = valcmp;
+	return csr;
 }
 
-void hashbst_insert(struct hashbst *hbst, void *key, void *val)
+void csrmap_free(struct csrmap *csr)
 {
-	struct hashbst_pair hpair = {
-		key, val
-	};
-
-	hash_insert(hbst->htable, &hpair);
-}
-
-void *hashbst_tree_search(struct hashbst *hbst, void *key, void *search, hbst_search_fn fn)
-{
-	/* Find entry with the key */
-	struct hashbst_tree *bst = hash_search(hbst->htable, key);
-	if (!bst) {
-		return NULL;
+	if (!csr) {
+		return;
 	}
 
-	return hashbst_tree_node_search(bst->root, search, fn);
-}
-
-/*******************************************************************************
- *
- * HASH_BST - Only to be used by hashbst
- *
- ******************************************************************************/
-
-/* Forward declaration */
-static void hash_free_bst(struct hash_table *htable);
-static void hash_insert_bst(struct hash_table *htable, void *data);
-static void *hash_search_bst(struct hash_table *htable, void *data);
-static int hash_pos_bst(struct hash_table *htable, void *data);
-
-static struct hash_vtbl hash_vtbl_bst = {
-	hash_free_bst,
-	hash_insert_bst,
-	hash_search_bst,
-	hash_pos_bst
-};
-
-static void hash_setup_bst(struct hash_table *htable)
-{
-	htable->vtbl = &hash_vtbl_bst;
+	hash_free(csr->rows);
+	free(csr->pairs);
+	free(csr->keys);
+	free(csr->offsets);
+	free(csr->vals);
+	free(csr);
 }
 
-static struct hash_table_entry *hash_entry_lookup_bst(unsigned long hash,
-											struct hash_table *htable, void *data)
+void csrmap_add(struct csrmap *csr, void *key, void *val)
 {
-	unsigned int pos = hash % htable->sz;
-	struct hash_table_entry *array = htable->table;
-
-	while (array[pos].u.tree.key) {
-		if (array[pos].hash == hash) {
-			if (!htable->cmp(array[pos].u.tree.key, data)) {
-				break;
-			}
-		}
-
-		if (++pos >= htable->sz) {
-			pos = 0;
-		}
+	if (csr->nr_pairs >= csr->max_pairs) {
+		csr->max_pairs = csr->max_pairs ? csr->max_pairs * 2 : 256;
+		csr->pairs = xrealloc(csr->pairs, csr->max_pairs * sizeof(struct csrmap_pair));
 	}
 
-	return array + pos;
+	csr->pairs[csr->nr_pairs].key = key;
+	csr->pairs[csr->nr_pairs].val = val;
+	csr->nr_pairs++;
 }
 
-/* Transfers the entire bst to its destination in htable */
-static void hash_entry_graft_tree(unsigned long hash, struct hash_table *htable,
-								  struct hashbst_tree *bst)
+/* Insertion sort, rows are short */
+static void csrmap_sort_row(void **vals, unsigned int nr, pw_hashcmp_fn cmp)
 {
-	unsigned int pos = hash % htable->sz;
-	struct hash_table_entry *array = htable->table;
-
-	while (array[pos].u.tree.key) {
-		if (array[pos].hash == hash) {
-			if (!htable->cmp(array[pos].u.tree.key, bst->key)) {
-				return;
-			}
-		}
+	unsigned int i, j;
+	void *val;
 
-		if (++pos >= htable->sz) {
-			pos = 0;
+	for (i = 1; i < nr; ++i) {
+		val = vals[i];
+		for (j = i; j > 0 && cmp(vals[j - 1], val) > 0; --j) {
+			vals[j] = vals[j - 1];
 		}
+		vals[j] = val;
 	}
-
-	array[pos].hash = hash;
-	array[pos].u.tree.key = bst->key;
-	array[pos].u.tree.root = bst->root;
-	htable->nr++;
 }
 
-/* Grows a hash table based on prime_list
- * returns 0 on success, -1 on failure.
- */
-static int hash_grow_bst(struct hash_table *htable)
+void csrmap_build(struct csrmap *csr)
 {
-	unsigned int new_size;
-	new_size = new_alloc_size(htable->sz);
-
-	if (new_size <= htable->sz) {
-		return -1;
-	}
-
-	/* Rehash */
-	struct hash_table_entry *old_table = htable->table;
-	unsigned int i;
-	unsigned int old_sz = htable->sz;
-	unsigned long hash;
+	unsigned int i, r, start, end, out;
+	unsigned int *rowof, *fill;
+	struct vidx_node node;
+	int pos;
 
-	htable->table = xcalloc(new_size, sizeof(struct hash_table_entry));
-	htable->sz = new_size;
-	htable->nr = 0;
-
-	for (i = 0; i < old_sz; ++i) {
-		if (old_table[i].u.tree.key) {
-			hash = old_table[i].hash;
-			hash_entry_graft_tree(hash, htable, &old_table[i].u.tree);
+	/* Stage the rows of an earlier build again, so that they survive */
+	if (csr->vals) {
+		for (r = 0; r < csr->nr_rows; ++r) {
+			for (i = csr->offsets[r]; i < csr->offsets[r + 1]; ++i) {
+				csrmap_add(csr, csr->keys[r], csr->vals[i]);
+			}
 		}
 	}
 
-	free(old_table);
-	return 0;
-}
+	/* Many pairs share a key, so the row table is left to grow as keys
+	 * turn up rather than being sized from nr_pairs
+	 */
+	rowof = xcalloc(csr->nr_pairs + 1, sizeof(unsigned int));
 
-static void hash_free_bst(struct hash_table *htable)
-{
-	if (!htable) {
-		return;
-	}
+	/* Assign rows to keys, counting the values of each row in offsets */
+	for (i = 0; i < csr->nr_pairs; ++i) {
+		pos = hash_pos(csr->rows, csr->pairs[i].key);
+		if (pos < 0) {
+			if (csr->nr_rows == csr->max_rows) {
+				csr->max_rows = csr->max_rows ? csr->max_rows * 2 : 256;
+				csr->keys = xrealloc(csr->keys, csr->max_rows * sizeof(void *));
+			}
 
-	unsigned int i;
-	struct hash_table_entry *array = htable->table;
-	for (i = 0; i < htable->sz; ++i) {
-		if (array[i].u.tree.root) {
-			hashbst_bst_free(&array[i].u.tree);
+			pos = csr->nr_rows++;
+			csr->keys[pos] = csr->pairs[i].key;
+			node.data = csr->pairs[i].key;
+			node.idx = pos;
+			hash_insert(csr->rows, &node);
 		}
+		rowof[i] = pos;
 	}
 
-	free(htable->table);
-	free(htable);
-}
-
-void hash_insert_bst(struct hash_table *htable, void *data)
-{
-	/* Maintain load factor of 1/2 */
-	if (htable->nr >= htable->sz / 2) {
-		if (hash_grow_bst(htable)) {
-			return;
-		}
+	free(csr->offsets);
+	csr->offsets = xcalloc(csr->nr_rows + 1, sizeof(unsigned int));
+	for (i = 0; i < csr->nr_pairs; ++i) {
+		csr->offsets[rowof[i] + 1]++;
 	}
 
-	/* Required casting for HASH_BST type */
-	struct hashbst_pair *hpair = data;
-	unsigned long hash = htable->hash(hpair->key);
-	struct hash_table_entry *entry = hash_entry_lookup_bst(hash, htable, hpair->key);
-
-	if (!entry->u.tree.key) {
-		/* Entire tree does not exist */
-		entry->hash = hash;
-		entry->u.tree.key = hpair->key;
-		htable->nr++;
+	for (r = 0; r < csr->nr_rows; ++r) {
+		csr->offsets[r + 1] += csr->offsets[r];
 	}
 
-	hashbst_bst_insert(&entry->u.tree, hpair->val, htable->cmp);
-}
-
-/* Internal use only, returns the entire hashbst_tree for the key (data)
- * @param htable hash table
- * @param data key to search for
- */
-void *hash_search_bst(struct hash_table *htable, void *data)
-{
-	unsigned long hash = htable->hash(data);
-	struct hash_table_entry *entry = hash_entry_lookup_bst(hash, htable, data);
-	if (entry->u.tree.root) {
-		return &entry->u.tree;
+	/* Scatter the values into their rows */
+	free(csr->vals);
+	csr->vals = xcalloc(csr->nr_pairs + 1, sizeof(void *));
+	fill = xcalloc(csr->nr_rows + 1, sizeof(unsigned int));
+	for (i = 0; i < csr->nr_pairs; ++i) {
+		r = rowof[i];
+		csr->vals[csr->offsets[r] + fill[r]++] = csr->pairs[i].val;
 	}
 
-	return NULL;
-}
-
-/* Placeholder, not in use for now */
-int hash_pos_bst(struct hash_table *htable, void *data)
-{
-	return -1;
-}
+	/* Sort each row and squeeze out duplicates */
+	for (r = 0, out = 0; r < csr->nr_rows; ++r) {
+		start = csr->offsets[r];
+		end = csr->offsets[r + 1];
+		csrmap_sort_row(csr->vals + start, end - start, csr->valcmp);
 
-/*******************************************************************************
- *
- * HASH_MAP
- *
- ******************************************************************************/
-
-/* hashmap - key-value pair data store */
-struct hashmap {
-	struct hash_table *htable;
-};
-
-/* Forward declarations */
-static void hash_insert_hmap(struct hash_table *htable, void *data);
-static void *hash_search_hmap(struct hash_table *htable, void *data);
-static int hash_pos_hmap(struct hash_table *htable, void *data);
-
-static struct hash_vtbl hash_vtbl_hmap = {
-	/* NOTE: Sharing function with htable */
-	hash_free_htable,
-	hash_insert_hmap,
-	hash_search_hmap,
-	hash_pos_hmap
-};
-
-static void hash_setup_hmap(struct hash_table *htable)
-{
-	htable->vtbl = &hash_vtbl_hmap;
-}
-
-static void hash_entry_insert_hmap(unsigned long hash, struct hash_table *htable,
-								   void *key, void *val)
-{
-	unsigned int pos = hash % htable->sz;
-	struct hash_table_entry *array = htable->table;
-
-	while (array[pos].u.pair.key) {
-		if (array[pos].hash == hash) {
-			if (!htable->cmp(array[pos].u.pair.key, key)) {
-				return;
+		csr->offsets[r] = out;
+		for (i = start; i < end; ++i) {
+			if (i == start || csr->valcmp(csr->vals[out - 1], csr->vals[i])) {
+				csr->vals[out++] = csr->vals[i];
 			}
 		}
-
-		if (++pos >= htable->sz) {
-			pos = 0;
-		}
 	}
+	csr->offsets[csr->nr_rows] = out;
 
-	array[pos].hash = hash;
-	array[pos].u.pair.key = key;
-	array[pos].u.pair.val = val;
-	htable->nr++;
+	free(fill);
+	free(rowof);
+	free(csr->pairs);
+	csr->pairs = NULL;
+	csr->nr_pairs = csr->max_pairs = 0;
 }
 
-static struct hash_table_entry *hash_entry_lookup_hmap(unsigned long hash,
-											struct hash_table *htable, void *key)
+void **csrmap_search(struct csrmap *csr, void *key, unsigned int *nr)
 {
-	unsigned int pos = hash % htable->sz;
-	struct hash_table_entry *array = htable->table;
-
-	while (array[pos].u.pair.key) {
-		if (array[pos].hash == hash) {
-			if (!htable->cmp(array[pos].u.pair.key, key)) {
-				break;
-			}
-		}
-
-		if (++pos >= htable->sz) {
-			pos = 0;
-		}
+	int r = hash_pos(csr->rows, key);
+	if (r < 0) {
+		*nr = 0;
+		return NULL;
 	}
 
-	return array + pos;
+	*nr = csr->offsets[r + 1] - csr->offsets[r];
+	return csr->vals + csr->offsets[r];
 }
 
-/* Grows a hash table based on prime_list
- * returns 0 on success, -1 on failure.
- */
-static int hash_grow_hmap(struct hash_table *htable)
+void *csrmap_find(struct csrmap *csr, void *key, void *search, csr_search_fn fn)
 {
-	unsigned int new_size;
-	new_size = new_alloc_size(htable->sz);
-
-	if (new_size <= htable->sz) {
-		return -1;
-	}
-
-	/* Rehash */
-	struct hash_table_entry *old_table = htable->table;
-	unsigned int i;
-	unsigned int old_sz = htable->sz;
-	unsigned long hash;
-
-	htable->table = xcalloc(new_size, sizeof(struct hash_table_entry));
-	htable->sz = new_size;
-	htable->nr = 0;
-
-	for (i = 0; i < old_sz; ++i) {
-		if (old_table[i].u.pair.key) {
-			hash = htable->hash(old_table[i].u.pair.key);
-			hash_entry_insert_hmap(hash, htable, old_table[i].u.pair.key,
-								   old_table[i].u.pair.val);
-		}
-	}
-
-	free(old_table);
-	return 0;
-}
+	unsigned int i, nr;
+	void **vals = csrmap_search(csr, key, &nr);
+	void *ret;
 
-void hash_insert_hmap(struct hash_table *htable, void *map_pair)
-{
-	/* Maintain load factor of 1/2 */
-	if (htable->nr >= htable->sz / 2) {
-		if (hash_grow_hmap(htable)) {
-			return;
+	for (i = 0; i < nr; ++i) {
+		ret = fn(search, vals[i]);
+		if (ret) {
+			return ret;
 		}
 	}
 
-	struct hashmap_pair *pair = map_pair;
-	unsigned long hash = htable->hash(pair->key);
-	struct hash_table_entry *entry = hash_entry_lookup_hmap(hash, htable, pair->key);
-	if (!entry->u.pair.key) {
-		entry->hash = hash;
-		entry->u.pair.key = pair->key;
-		entry->u.pair.val = pair->val;
-		htable->nr++;
-	}
-}
-
-void *hash_search_hmap(struct hash_table *htable, void *key)
-{
-	struct hash_table_entry *entry;
-	unsigned long hash = htable->hash(key);
-
-	entry = hash_entry_lookup_hmap(hash, htable, key);
-	return entry->u.pair.val ? entry->u.pair.val : NULL;
+	return NULL;
 }
 
-int hash_pos_hmap(struct hash_table *htable, void *key)
+void csrmap_stats(struct csrmap *csr, const char *name, enum pwloglevel_t lvl)
 {
-	struct hash_table_entry *entry;
-	unsigned long hash = htable->hash(key);
-	entry = hash_entry_lookup_hmap(hash, htable, key);
+	unsigned int r, len, longest = 0;
 
-	if (entry->u.pair.key) {
-		return entry - htable->table;
+	hash_stats_print(csr->rows, name, lvl);
+	for (r = 0; r < csr->nr_rows; ++r) {
+		len = csr->offsets[r + 1] - csr->offsets[r];
+		if (len > longest) {
+			longest = len;
+		}
 	}
 
-	return -1;
+	pw_printf(lvl, "hash: %s: %u keys, %u values, longest row %u\n", name,
+			  csr->nr_rows, csr->nr_rows ? csr->offsets[csr->nr_rows] : 0, longest);
 }
 
 /*******************************************************************************
@@ -943,6 +722,11 @@ int hash_pos_hmap(struct hash_table *htable, void *key)
  *
  ******************************************************************************/
 
+/* hashmap - key-value pair data store */
+struct hashmap {
+	struct hash_table *htable;
+};
+
 struct hashmap *hashmap_new(pw_hash_fn hashfn, pw_hashcmp_fn hashcmp)
 {
 	struct hashmap *hmap = xcalloc(1, sizeof(struct hashmap));
@@ -969,3 +753,13 @@ void *hashmap_search(struct hashmap *hmap, void *key)
 {
 	return hash_search(hmap->htable, key);
 }
+
+void hashmap_reserve(struct hashmap *hmap, unsigned int nr)
+{
+	hash_reserve(hmap->htable, nr);
+}
+
+void hashmap_stats(struct hashmap *hmap, const char *name, enum pwloglevel_t lvl)
+{
+	hash_stats_print(hmap->htable, name, lvl);
+}
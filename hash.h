@@ -3,6 +3,8 @@
 
 #include <alpm.h>
 
+#include "powaur.h"
+
 /* Opaque */
 struct hash_table;
 
@@ -10,7 +12,6 @@ struct hash_table;
 enum hash_type {
 	HASH_TABLE,
 	VINDEX,
-	HASH_BST,
 	HASH_MAP
 };
 
@@ -20,9 +21,6 @@ struct vidx_node {
 	int idx;
 };
 
-/* returns an appropriate allocation size */
-unsigned int new_alloc_size(unsigned int old_sz);
-
 /*******************************************************************************
  *
  * General hash table functions
@@ -53,32 +51,56 @@ alpm_list_t *hash_to_list(struct hash_table *table);
  */
 void hash_walk(struct hash_table *table, void (*fn) (void *));
 
+/* Sizes the table so that nr entries fit without growing */
+void hash_reserve(struct hash_table *table, unsigned int nr);
+
+/* Prints load factor and probe statistics of a table at log level lvl */
+void hash_stats(struct hash_table *table, const char *name, enum pwloglevel_t lvl);
+
+/* Inserts every entry of src into dst, reusing the stored hashes.
+ * Entries already in dst are kept. Only valid for HASH_TABLE.
+ */
+void hash_merge(struct hash_table *dst, struct hash_table *src);
+
 /*******************************************************************************
  *
- * Hash BST functions
+ * CSR map functions
  *
  ******************************************************************************/
 
-/* Associative array, maps key to a tree of values */
-struct hashbst;
+/* Maps a key to a sorted, contiguous array of values.
+ * Pairs are added first, then csrmap_build lays them out. Searching is only
+ * valid after csrmap_build. Pairs added after a build are only seen once
+ * csrmap_build is called again, which keeps the rows already built.
+ */
+struct csrmap;
 
-/* tree_search function prototype
+/* csrmap_find function prototype
  * @param search external search structure
  * @param val value to search for
  */
-typedef void *(*hbst_search_fn) (void *search, void *val);
+typedef void *(*csr_search_fn) (void *search, void *val);
+
+struct csrmap *csrmap_new(pw_hash_fn hashfn, pw_hashcmp_fn keycmp,
+						  pw_hashcmp_fn valcmp);
+void csrmap_free(struct csrmap *csr);
+void csrmap_add(struct csrmap *csr, void *key, void *val);
+
+/* Sorts the added pairs into rows, drops duplicate values */
+void csrmap_build(struct csrmap *csr);
 
-struct hashbst *hashbst_new(pw_hash_fn hashfn, pw_hashcmp_fn hashcmp);
-void hashbst_free(struct hashbst *hbst);
-void hashbst_insert(struct hashbst *hbst, void *key, void *val);
+/* returns the values of key, and their number in nr */
+void **csrmap_search(struct csrmap *csr, void *key, unsigned int *nr);
 
-/* Search for a key in search structure search fulfilling criteria given by fn
- * @param hbst hash bst
- * @param key key to search for in hash bst
+/* Scans the values of key in order, returning the first non-NULL result of fn
+ * @param csr csr map
+ * @param key key to search for
  * @param search external search structure
- * @param fn function to use in search walking
+ * @param fn function applied to each value
  */
-void *hashbst_tree_search(struct hashbst *hbst, void *key, void *search, hbst_search_fn fn);
+void *csrmap_find(struct csrmap *csr, void *key, void *search, csr_search_fn fn);
+
+void csrmap_stats(struct csrmap *csr, const char *name, enum pwloglevel_t lvl);
 
 /*******************************************************************************
  *
@@ -99,5 +121,7 @@ void hashmap_insert(struct hashmap *hmap, void *key, void *val);
  * @param key key to search for
  */
 void *hashmap_search(struct hashmap *hmap, void *key);
+void hashmap_reserve(struct hashmap *hmap, unsigned int nr);
+void hashmap_stats(struct hashmap *hmap, const char *name, enum pwloglevel_t lvl);
 
 #endif
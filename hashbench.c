@@ -0,0 +1,121 @@
+/* hashbench, built by "make bench"
+ *
+ * Times sdbm against pw_strhash on the real local and sync package names,
+ * and prints the distribution of a hash table built with each.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <alpm.h>
+#include <alpm_list.h>
+
+#include "environment.h"
+#include "hash.h"
+#include "hashdb.h"
+#include "intern.h"
+#include "util.h"
+
+#define HASHBENCH_ROUNDS 200
+
+static double timespec_diff(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Times fn over names and prints the distribution of a table built with it */
+static void hashbench_fn(const char *setname, const char *fnname, pw_hash_fn fn,
+						 alpm_list_t *names, size_t nbytes)
+{
+	alpm_list_t *i;
+	struct timespec start, end;
+	struct hash_table *htable;
+	unsigned long sink = 0;
+	unsigned int nr = alpm_list_count(names);
+	char label[64];
+	double secs;
+	int round;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (round = 0; round < HASHBENCH_ROUNDS; ++round) {
+		for (i = names; i; i = i->next) {
+			sink += fn(i->data);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = timespec_diff(&start, &end);
+	pw_printf(PW_LOG_INFO, "%s %s: %.1f ns/name, %.0f MB/s (%lx)\n", setname, fnname,
+			  secs * 1e9 / ((double) nr * HASHBENCH_ROUNDS),
+			  (double) nbytes * HASHBENCH_ROUNDS / secs / 1e6, sink & 0xf);
+
+	htable = hash_new(HASH_TABLE, fn, (pw_hashcmp_fn) strcmp);
+	for (i = names; i; i = i->next) {
+		hash_insert(htable, i->data);
+	}
+
+	snprintf(label, 64, "%s %s", setname, fnname);
+	hash_stats(htable, label, PW_LOG_INFO);
+	hash_free(htable);
+}
+
+static void hashbench_set(const char *setname, struct hash_table *pkgs)
+{
+	alpm_list_t *i, *pairs, *names = NULL;
+	struct pkgpair *pkgpair;
+	size_t nbytes = 0;
+
+	pairs = hash_to_list(pkgs);
+	for (i = pairs; i; i = i->next) {
+		pkgpair = i->data;
+		names = alpm_list_add(names, (void *) pkgpair->pkgname);
+		nbytes += strlen(pkgpair->pkgname);
+	}
+	alpm_list_free(pairs);
+
+	pw_printf(PW_LOG_INFO, "%s: %zu package names, %lu bytes\n", setname,
+			  alpm_list_count(names), (unsigned long) nbytes);
+	hashbench_fn(setname, "sdbm", (pw_hash_fn) sdbm, names, nbytes);
+	hashbench_fn(setname, "pw_strhash", (pw_hash_fn) pw_strhash, names, nbytes);
+	alpm_list_free(names);
+}
+
+/* Compares sdbm against pw_strhash on the local and sync package names */
+int main(int argc, char *argv[])
+{
+	struct pw_hashdb *hashdb;
+	int ret = 1;
+
+	pw_hash_init();
+	if (setup_config()) {
+		return 1;
+	}
+
+	if (setup_environment()) {
+		goto cleanup;
+	}
+
+	config->color = 0;
+	colors_setup();
+
+	hashdb = build_hashdb();
+	if (!hashdb) {
+		pw_fprintf(PW_LOG_ERROR, stderr, "Failed to build hash database.\n");
+		goto cleanup;
+	}
+
+	hashbench_set("local", hashdb->local);
+	hashbench_set("sync", hashdb->sync);
+	hashdb_free(hashdb);
+	ret = 0;
+
+cleanup:
+	intern_cleanup();
+	if (config) {
+		alpm_release(config->handle);
+	}
+	cleanup_environment();
+	return ret;
+}
+
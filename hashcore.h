@@ -0,0 +1,239 @@
+/* Open addressing core, included by hash.c once per entry layout.
+ *
+ * Before including, define:
+ *   HC_PREFIX  prefix of the generated functions, eg. htable
+ *   HC_ENTRY   entry type, a struct with at least
+ *                void *key;
+ *                uint32_t hash;
+ *
+ * Everything generated is static, and calls to cmp are the only indirect
+ * calls left. HC_PREFIX and HC_ENTRY are undefined at the end.
+ */
+
+#define HC_CAT2(a, b) a##_##b
+#define HC_CAT(a, b) HC_CAT2(a, b)
+#define HC(name) HC_CAT(HC_PREFIX, name)
+
+static void HC(alloc)(struct hash_table *htable, unsigned int sz)
+{
+	hash_ctrl_alloc(htable, sz);
+	htable->table = xcalloc(sz, sizeof(HC_ENTRY));
+}
+
+/* Returns the entry with the given key in one set of arrays, NULL if it is
+ * not there. Groups are probed triangularly, which visits every group since
+ * the number of groups is a power of 2.
+ */
+static inline HC_ENTRY *HC(probe)(struct hash_table *htable, unsigned char *ctrl,
+								  HC_ENTRY *table, unsigned int sz, uint32_t hash,
+								  void *key)
+{
+	unsigned int mask = sz - 1;
+	unsigned int pos = hash_h1(hash) & mask;
+	unsigned int stride = 0;
+	unsigned int match, bit;
+	unsigned char h2 = hash_h2(hash);
+	HC_ENTRY *entry;
+
+	for (;;) {
+		match = group_match(ctrl + pos, h2);
+		while (match) {
+			bit = __builtin_ctz(match);
+			match &= match - 1;
+
+			/* Only call cmp when the full hash matches */
+			entry = table + ((pos + bit) & mask);
+			if (entry->hash == hash && !htable->cmp(entry->key, key)) {
+				return entry;
+			}
+		}
+
+		if (group_match_empty(ctrl + pos)) {
+			return NULL;
+		}
+
+		stride += HASH_GROUP_WIDTH;
+		pos = (pos + stride) & mask;
+	}
+}
+
+/* Returns the entry with the given key, NULL if it is not in the table.
+ * Does not modify the table, so concurrent lookups are fine.
+ */
+static inline HC_ENTRY *HC(find)(struct hash_table *htable, uint32_t hash, void *key)
+{
+	HC_ENTRY *entry;
+
+	entry = HC(probe)(htable, htable->ctrl, htable->table, htable->sz, hash, key);
+	if (!entry && htable->old_table) {
+		entry = HC(probe)(htable, htable->old_ctrl, htable->old_table,
+						  htable->old_sz, hash, key);
+	}
+
+	return entry;
+}
+
+/* Moves an entry into a free slot of the current arrays */
+static inline void HC(move)(struct hash_table *htable, HC_ENTRY *entry)
+{
+	unsigned int pos = hash_find_slot(htable, entry->hash);
+	hash_set_ctrl(htable, pos, hash_h2(entry->hash));
+	((HC_ENTRY *) htable->table)[pos] = *entry;
+}
+
+/* Moves up to nr slots of the old arrays over, freeing them once done */
+static void HC(migrate)(struct hash_table *htable, unsigned int nr)
+{
+	HC_ENTRY *old_table = htable->old_table;
+	unsigned int i;
+
+	while (nr-- && htable->old_next < htable->old_sz) {
+		i = htable->old_next++;
+		if (ctrl_full(htable->old_ctrl[i])) {
+			HC(move)(htable, old_table + i);
+			htable->old_nr--;
+		}
+	}
+
+	if (htable->old_next >= htable->old_sz) {
+		hash_old_free(htable);
+	}
+}
+
+static void HC(migrate_all)(struct hash_table *htable)
+{
+	if (htable->old_table) {
+		HC(migrate)(htable, htable->old_sz);
+	}
+}
+
+/* Moves every entry into new arrays of size new_size at once */
+static void HC(rehash)(struct hash_table *htable, unsigned int new_size)
+{
+	unsigned char *old_ctrl;
+	HC_ENTRY *old_table;
+	unsigned int old_sz, i;
+
+	HC(migrate_all)(htable);
+	old_ctrl = htable->ctrl;
+	old_table = htable->table;
+	old_sz = htable->sz;
+
+	HC(alloc)(htable, new_size);
+	for (i = 0; i < old_sz; ++i) {
+		if (ctrl_full(old_ctrl[i])) {
+			HC(move)(htable, old_table + i);
+		}
+	}
+
+	free(old_ctrl);
+	free(old_table);
+}
+
+/* Doubles the size of a hash table. Entries are moved over by later inserts.
+ * returns 0 on success, -1 on failure.
+ */
+static int HC(grow)(struct hash_table *htable)
+{
+	unsigned int new_size = htable->sz * 2;
+	if (new_size <= htable->sz) {
+		return -1;
+	}
+
+	/* Should not happen with HASH_MIGRATE_STEP >= 2 */
+	HC(migrate_all)(htable);
+
+	htable->old_ctrl = htable->ctrl;
+	htable->old_table = htable->table;
+	htable->old_sz = htable->sz;
+	htable->old_nr = htable->nr;
+	htable->old_next = 0;
+
+	HC(alloc)(htable, new_size);
+	return 0;
+}
+
+/* Claims an empty slot for a key which is not in the table yet.
+ * The caller fills in the rest of the returned entry.
+ * returns NULL if the table cannot grow.
+ */
+static HC_ENTRY *HC(claim)(struct hash_table *htable, uint32_t hash, void *key)
+{
+	HC_ENTRY *entry;
+	unsigned int pos;
+
+	if (htable->old_table) {
+		HC(migrate)(htable, HASH_MIGRATE_STEP);
+	}
+
+	/* Entries still in the old arrays do not take up room in the new ones */
+	if (htable->nr - htable->old_nr >= hash_capacity(htable)) {
+		if (HC(grow)(htable)) {
+			return NULL;
+		}
+	}
+
+	pos = hash_find_slot(htable, hash);
+	hash_set_ctrl(htable, pos, hash_h2(hash));
+	htable->nr++;
+
+	entry = (HC_ENTRY *) htable->table + pos;
+	entry->hash = hash;
+	entry->key = key;
+	return entry;
+}
+
+/* Position of an entry, entries in the old arrays come after the new ones */
+static inline int HC(index)(struct hash_table *htable, HC_ENTRY *entry)
+{
+	HC_ENTRY *table = htable->table;
+	if (entry >= table && entry < table + htable->sz) {
+		return entry - table;
+	}
+
+	return htable->sz + (entry - (HC_ENTRY *) htable->old_table);
+}
+
+/* Iterates over every entry, including those not migrated yet.
+ * Start with *it = 0, returns NULL at the end.
+ */
+static inline HC_ENTRY *HC(next)(struct hash_table *htable, unsigned int *it)
+{
+	unsigned int i;
+
+	while (*it < htable->sz) {
+		i = (*it)++;
+		if (ctrl_full(htable->ctrl[i])) {
+			return (HC_ENTRY *) htable->table + i;
+		}
+	}
+
+	if (!htable->old_table) {
+		return NULL;
+	}
+
+	if (*it < htable->sz + htable->old_next) {
+		*it = htable->sz + htable->old_next;
+	}
+
+	while (*it < htable->sz + htable->old_sz) {
+		i = (*it)++ - htable->sz;
+		if (ctrl_full(htable->old_ctrl[i])) {
+			return (HC_ENTRY *) htable->old_table + i;
+		}
+	}
+
+	return NULL;
+}
+
+/* Stored hash of a full slot in the current arrays, for hash_stats */
+static uint32_t HC(slot_hash)(struct hash_table *htable, unsigned int pos)
+{
+	return ((HC_ENTRY *) htable->table)[pos].hash;
+}
+
+#undef HC
+#undef HC_CAT
+#undef HC_CAT2
+#undef HC_PREFIX
+#undef HC_ENTRY
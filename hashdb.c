@@ -1,36 +1,46 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <alpm.h>
 #include "environment.h"
 #include "hashdb.h"
 #include "hash.h"
-#include "memlist.h"
+#include "intern.h"
 #include "powaur.h"
 #include "wrapper.h"
 #include "util.h"
 
+/* Chunk size of the pkgpair pools, about 2700 pkgpairs each */
+#define HASHDB_POOL_CHUNK 65536
+
 struct pw_hashdb *hashdb_new(void)
 {
 	struct pw_hashdb *hashdb = xcalloc(1, sizeof(struct pw_hashdb));
 
 	/* Local, sync, AUR db hash tables of struct pkgpair */
-	hashdb->local = hash_new(HASH_TABLE, pkgpair_sdbm, pkgpair_cmp);
-	hashdb->sync  = hash_new(HASH_TABLE, pkgpair_sdbm, pkgpair_cmp);
-	hashdb->aur   = hash_new(HASH_TABLE, pkgpair_sdbm, pkgpair_cmp);
+	hashdb->local = hash_new(HASH_TABLE, pkgpair_hash, pkgpair_cmp);
+	hashdb->sync  = hash_new(HASH_TABLE, pkgpair_hash, pkgpair_cmp);
+	hashdb->aur   = hash_new(HASH_TABLE, pkgpair_hash, pkgpair_cmp);
 
-	hashdb->aur_downloaded = hash_new(HASH_TABLE, (pw_hash_fn) sdbm, (pw_hashcmp_fn) strcmp);
-	hashdb->aur_outdated   = hash_new(HASH_TABLE, (pw_hash_fn) sdbm, (pw_hashcmp_fn) strcmp);
+	hashdb->aur_downloaded = hash_new(HASH_TABLE, (pw_hash_fn) pw_strhash, intern_cmp);
+	hashdb->aur_outdated   = hash_new(HASH_TABLE, (pw_hash_fn) pw_strhash, intern_cmp);
 
 	/* Local and sync provides */
-	hashdb->local_provides = hashbst_new((pw_hash_fn) sdbm, (pw_hashcmp_fn) strcmp);
-	hashdb->sync_provides  = hashbst_new((pw_hash_fn) sdbm, (pw_hashcmp_fn) strcmp);
+	hashdb->local_provides = csrmap_new((pw_hash_fn) pw_strhash, intern_cmp,
+										intern_cmp);
+	hashdb->sync_provides  = csrmap_new((pw_hash_fn) pw_strhash, intern_cmp,
+										intern_cmp);
 
 	/* Cache provided->providing key-value mapping */
-	hashdb->provides_cache = hashmap_new((pw_hash_fn) sdbm, (pw_hashcmp_fn) strcmp);
-	hashdb->pkg_from = hashmap_new((pw_hash_fn) sdbm, (pw_hashcmp_fn) strcmp);
+	hashdb->provides_cache = hashmap_new((pw_hash_fn) pw_strhash, intern_cmp);
+	hashdb->pkg_from = hashmap_new((pw_hash_fn) pw_strhash, intern_cmp);
 
-	hashdb->strpool = memlist_new(4096, sizeof(char *), MEMLIST_PTR);
-	hashdb->pkgpool = memlist_new(4096, sizeof(struct pkgpair), MEMLIST_NORM);
+	hashdb->pkgpool = arena_new(HASHDB_POOL_CHUNK);
 
 	/* Initialize pkgfrom_t */
 	hashdb->pkg_from_unknown = PKG_FROM_UNKNOWN;
@@ -42,79 +52,589 @@ struct pw_hashdb *hashdb_new(void)
 
 void hashdb_free(struct pw_hashdb *hashdb)
 {
+	size_t used, total;
+
 	if (!hashdb) {
 		return;
 	}
 
+	if (config->loglvl & PW_LOG_DEBUG) {
+		hash_stats(hashdb->local, "local", PW_LOG_DEBUG);
+		hash_stats(hashdb->sync, "sync", PW_LOG_DEBUG);
+		hash_stats(hashdb->aur, "aur", PW_LOG_DEBUG);
+		csrmap_stats(hashdb->local_provides, "local provides", PW_LOG_DEBUG);
+		csrmap_stats(hashdb->sync_provides, "sync provides", PW_LOG_DEBUG);
+		hashmap_stats(hashdb->provides_cache, "provides cache", PW_LOG_DEBUG);
+		hashmap_stats(hashdb->pkg_from, "pkg_from", PW_LOG_DEBUG);
+
+		arena_usage(hashdb->pkgpool, &used, &total);
+		pw_printf(PW_LOG_DEBUG, "pkgpool: %zu of %zu bytes used\n", used, total);
+	}
+
 	hash_free(hashdb->local);
 	hash_free(hashdb->sync);
 	hash_free(hashdb->aur);
 	hash_free(hashdb->aur_downloaded);
 	hash_free(hashdb->aur_outdated);
 	alpm_list_free(hashdb->immediate_deps);
-	hashbst_free(hashdb->local_provides);
-	hashbst_free(hashdb->sync_provides);
+	csrmap_free(hashdb->local_provides);
+	csrmap_free(hashdb->sync_provides);
 	hashmap_free(hashdb->provides_cache);
 	hashmap_free(hashdb->pkg_from);
-	memlist_free(hashdb->strpool);
-	memlist_free(hashdb->pkgpool);
+	arena_free(hashdb->pkgpool);
+
 	free(hashdb);
 }
 
-/* hashes packages and their provides
- * @param dbcache list of alpm_pkg_t * to be hashed
- * @param htable hash table hashing struct pkgpair
- * @param provides hashbst used to hash provides
- * @param hashdb hash database
+/* What hash_packages needs of a package, read from libalpm beforehand */
+struct hashdb_pkg {
+	alpm_pkg_t *pkg;
+	const char *name;
+	alpm_list_t *provides;
+};
+
+/* A provide found by a worker, interned and added on the main thread */
+struct hashdb_prov {
+	const char *name;
+	struct pkgpair *provider;
+};
+
+/* Per database state for a hashdb build thread.
+ * Everything here is private to the thread until it is joined.
  */
-static void hash_packages(alpm_list_t *dbcache, struct hash_table *htable,
-						  struct hashbst *provides, struct pw_hashdb *hashdb)
+struct hashdb_worker {
+	pthread_t tid;
+	int started;
+
+	alpm_db_t *db;
+	alpm_list_t *dbcache;
+	struct hashdb_pkg *pkgdata;
+	unsigned int npkgs;
+
+	/* Package names are not interned yet */
+	struct hash_table *pkgs;
+	struct pkgpair *pairs;
+	struct arena *pkgpool;
+
+	struct hashdb_prov *provs;
+	unsigned int nprovs;
+	unsigned int maxprovs;
+
+	/* Provide names, freed once they are interned */
+	struct arena *strpool;
+};
+
+/* hashes packages and collects their provides
+ * Only reads worker->pkgdata, libalpm is not called here. Names are left
+ * for hashdb_worker_intern so that workers never touch the interner.
+ */
+static void hash_packages(struct hashdb_worker *worker)
 {
-	alpm_list_t *i, *k;
-	alpm_pkg_t *pkg;
+	alpm_list_t *k;
 	alpm_depend_t *dep;
-	struct pkgpair pkgpair;
-	void *memlist_ptr;
+	struct hashdb_pkg *pkg;
+	struct hashdb_prov *prov;
+	unsigned int i;
 
 	char buf[1024];
-	char *dupstr;
-	const char *pkgname;
 
-	for (i = dbcache; i; i = i->next) {
-		pkg = i->data;
-		pkgname = alpm_pkg_get_name(pkg);
-
-		pkgpair.pkgname = pkgname;
-		pkgpair.pkg = pkg;
-		memlist_ptr = memlist_add(hashdb->pkgpool, &pkgpair);
-		hash_insert(htable, memlist_ptr);
+	worker->pairs = arena_calloc(worker->pkgpool, worker->npkgs + 1,
+								 sizeof(struct pkgpair));
+	for (i = 0; i < worker->npkgs; ++i) {
+		pkg = &worker->pkgdata[i];
+		worker->pairs[i].pkgname = pkg->name;
+		worker->pairs[i].pkg = pkg->pkg;
+		worker->pairs[i].db = worker->db;
+		hash_insert(worker->pkgs, &worker->pairs[i]);
 
 		/* Provides */
-		for (k = alpm_pkg_get_provides(pkg); k; k = k->next) {
+		for (k = pkg->provides; k; k = k->next) {
 			dep = k->data;
 			snprintf(buf, 1024, "%s", dep->name);
 			if (!strtrim_ver(buf)) {
 				continue;
 			}
 
-			dupstr = xstrdup(buf);
-			memlist_ptr = memlist_add(hashdb->strpool, &dupstr);
-			hashbst_insert(provides, memlist_ptr, (void *) pkgname);
+			if (worker->nprovs == worker->maxprovs) {
+				worker->maxprovs = worker->maxprovs ? worker->maxprovs * 2 : 64;
+				worker->provs = xrealloc(worker->provs,
+										 worker->maxprovs * sizeof(struct hashdb_prov));
+			}
+
+			prov = &worker->provs[worker->nprovs++];
+			prov->name = arena_strdup(worker->strpool, buf);
+			prov->provider = &worker->pairs[i];
+		}
+	}
+}
+
+/* Interns the names found by a joined worker and adds its provides to
+ * provides. Runs on the main thread, so the interner sees no contention.
+ * Interning keeps the hashes of the packages as they are.
+ * worker->provs is kept, with interned names, for hashdb_save_image.
+ */
+static void hashdb_worker_intern(struct hashdb_worker *worker,
+								 struct csrmap *provides)
+{
+	unsigned int i;
+
+	for (i = 0; i < worker->npkgs; ++i) {
+		worker->pairs[i].pkgname = intern(worker->pairs[i].pkgname);
+	}
+
+	for (i = 0; i < worker->nprovs; ++i) {
+		worker->provs[i].name = intern(worker->provs[i].name);
+		csrmap_add(provides, (void *) worker->provs[i].name,
+				   (void *) worker->provs[i].provider->pkgname);
+	}
+
+	arena_free(worker->strpool);
+	worker->strpool = NULL;
+}
+
+/* Frees what is left of the workers once the hashdb is built */
+static void hashdb_workers_free(struct hashdb_worker *workers, int ndbs)
+{
+	int i;
+
+	for (i = 0; i < ndbs; ++i) {
+		free(workers[i].provs);
+	}
+
+	free(workers);
+}
+
+static void *thread_hash_packages(void *arg)
+{
+	struct hashdb_worker *worker = arg;
+
+	hash_reserve(worker->pkgs, worker->npkgs);
+	hash_packages(worker);
+	return NULL;
+}
+
+/* Reads everything hash_packages needs out of libalpm.
+ * libalpm is not thread safe: loading a pkgcache, or the lazily loaded
+ * desc of a local package, writes to the shared handle. This is done on
+ * the calling thread before any worker starts.
+ */
+static void hashdb_worker_load(struct hashdb_worker *worker)
+{
+	alpm_list_t *i;
+	alpm_pkg_t *pkg;
+	unsigned int idx;
+
+	worker->dbcache = alpm_db_get_pkgcache(worker->db);
+	worker->npkgs = alpm_list_count(worker->dbcache);
+	worker->pkgdata = xcalloc(worker->npkgs + 1, sizeof(struct hashdb_pkg));
+
+	for (i = worker->dbcache, idx = 0; i; i = i->next, ++idx) {
+		pkg = i->data;
+		worker->pkgdata[idx].pkg = pkg;
+		worker->pkgdata[idx].name = alpm_pkg_get_name(pkg);
+		worker->pkgdata[idx].provides = alpm_pkg_get_provides(pkg);
+	}
+}
+
+/* Reads every db, then hashes each one on its own thread.
+ * Returns an array of ndbs workers which have all finished.
+ */
+static struct hashdb_worker *hash_databases(alpm_db_t **dbs, int ndbs)
+{
+	int i;
+	struct hashdb_worker *workers = xcalloc(ndbs, sizeof(struct hashdb_worker));
+
+	for (i = 0; i < ndbs; ++i) {
+		workers[i].db = dbs[i];
+		hashdb_worker_load(&workers[i]);
+	}
+
+	for (i = 0; i < ndbs; ++i) {
+		workers[i].pkgs = hash_new(HASH_TABLE, pkgpair_hash, pkgpair_cmp);
+		workers[i].pkgpool = arena_new(HASHDB_POOL_CHUNK);
+		workers[i].strpool = arena_new(HASHDB_POOL_CHUNK);
+
+		/* Fall back to hashing it here if we cannot get a thread */
+		if (!pthread_create(&workers[i].tid, NULL, thread_hash_packages, &workers[i])) {
+			workers[i].started = 1;
+		} else {
+			thread_hash_packages(&workers[i]);
+		}
+	}
+
+	for (i = 0; i < ndbs; ++i) {
+		if (workers[i].started) {
+			pthread_join(workers[i].tid, NULL);
+		}
+
+		free(workers[i].pkgdata);
+		workers[i].pkgdata = NULL;
+	}
+
+	return workers;
+}
+
+/*******************************************************************************
+ *
+ * hashdb image
+ *
+ * The hashdb is saved to powaur_dir/hashdb so that later runs can map it in
+ * instead of walking every pkgcache. Layout:
+ *
+ *   struct hashdb_img_hdr
+ *   struct hashdb_img_db   x ndbs   (local first, then sync dbs in order)
+ *   struct hashdb_img_pkg  x npkgs
+ *   struct hashdb_img_prov x nprovides
+ *   string table, strings are referred to by offset
+ *
+ * The image is only used if the dbs, their sizes and their mtimes, down to
+ * the nanosecond, are unchanged. Adding or removing a local package changes
+ * the mtime of the local db directory.
+ *
+ ******************************************************************************/
+
+#define HASHDB_IMG_FILE    "hashdb"
+#define HASHDB_IMG_MAGIC   "PWHASHDB"
+#define HASHDB_IMG_VERSION 2
+
+/* struct hashdb_img_pkg flags */
+#define HASHDB_IMG_AUR 0x1
+
+struct hashdb_img_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t ndbs;
+	uint32_t npkgs;
+	uint32_t nprovides;
+	uint32_t strsz;
+	uint32_t pad;
+};
+
+struct hashdb_img_db {
+	uint32_t name;
+	uint32_t pad;
+	int64_t mtime;
+	int64_t mtime_nsec;
+	int64_t size;
+};
+
+struct hashdb_img_pkg {
+	uint32_t name;
+	uint16_t db;
+	uint16_t flags;
+};
+
+struct hashdb_img_prov {
+	uint32_t name;
+	uint32_t provider;
+	uint16_t db;
+	uint16_t pad;
+	uint32_t pad2;
+};
+
+/* Growable buffer used to build an image */
+struct imgbuf {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+static void imgbuf_add(struct imgbuf *buf, const void *data, size_t len)
+{
+	if (buf->len + len > buf->cap) {
+		buf->cap = buf->len + len > 2 * buf->cap ? buf->len + len : 2 * buf->cap;
+		buf->data = xrealloc(buf->data, buf->cap);
+	}
+
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+/* returns the offset of str in the string table */
+static uint32_t imgbuf_addstr(struct imgbuf *strtab, const char *str)
+{
+	uint32_t off = strtab->len;
+	imgbuf_add(strtab, str, strlen(str) + 1);
+	return off;
+}
+
+/* Fills in the path and stat of db, local db is its directory */
+static int hashdb_db_stat(alpm_db_t *db, int local, struct stat *st)
+{
+	char path[PATH_MAX];
+
+	if (local) {
+		snprintf(path, PATH_MAX, "%s/local", pacman_dbpath);
+	} else {
+		snprintf(path, PATH_MAX, "%s/sync/%s.db", pacman_dbpath,
+				 alpm_db_get_name(db));
+	}
+
+	return stat(path, st);
+}
+
+static void hashdb_image_path(char *buf, size_t sz)
+{
+	snprintf(buf, sz, "%s/%s", powaur_dir, HASHDB_IMG_FILE);
+}
+
+/* Saves the image of a freshly built hashdb.
+ * The packages and provides come from the arrays the workers collected,
+ * workers[0] being the local db.
+ */
+static void hashdb_save_image(struct pw_hashdb *hashdb,
+							  struct hashdb_worker *workers, int ndbs)
+{
+	struct hashdb_img_hdr hdr;
+	struct hashdb_img_db imgdb;
+	struct hashdb_img_pkg imgpkg;
+	struct hashdb_img_prov imgprov;
+	struct imgbuf dbs, pkgs, provs, strtab;
+	struct hashdb_worker *worker;
+	struct stat st;
+	uint32_t *nameoff = NULL;
+	unsigned int k;
+	uint16_t dbidx;
+	char path[PATH_MAX];
+	char tmppath[PATH_MAX];
+	int fd, ret = 0;
+	FILE *fp;
+
+	memset(&dbs, 0, sizeof(struct imgbuf));
+	memset(&pkgs, 0, sizeof(struct imgbuf));
+	memset(&provs, 0, sizeof(struct imgbuf));
+	memset(&strtab, 0, sizeof(struct imgbuf));
+	memset(&hdr, 0, sizeof(hdr));
+
+	for (dbidx = 0; dbidx < ndbs; ++dbidx) {
+		worker = &workers[dbidx];
+		if (hashdb_db_stat(worker->db, dbidx == 0, &st)) {
+			goto cleanup;
+		}
+
+		memset(&imgdb, 0, sizeof(imgdb));
+		imgdb.name = imgbuf_addstr(&strtab, alpm_db_get_name(worker->db));
+		imgdb.mtime = st.st_mtim.tv_sec;
+		imgdb.mtime_nsec = st.st_mtim.tv_nsec;
+		imgdb.size = st.st_size;
+		imgbuf_add(&dbs, &imgdb, sizeof(imgdb));
+		hdr.ndbs++;
+
+		/* Offsets of the package names, for their provides */
+		nameoff = xrealloc(nameoff, (worker->npkgs + 1) * sizeof(uint32_t));
+		for (k = 0; k < worker->npkgs; ++k) {
+			memset(&imgpkg, 0, sizeof(imgpkg));
+			imgpkg.name = imgbuf_addstr(&strtab, worker->pairs[k].pkgname);
+			imgpkg.db = dbidx;
+
+			if (dbidx == 0 && hash_search(hashdb->aur, &worker->pairs[k])) {
+				imgpkg.flags |= HASHDB_IMG_AUR;
+			}
+
+			nameoff[k] = imgpkg.name;
+			imgbuf_add(&pkgs, &imgpkg, sizeof(imgpkg));
+			hdr.npkgs++;
+		}
+
+		for (k = 0; k < worker->nprovs; ++k) {
+			memset(&imgprov, 0, sizeof(imgprov));
+			imgprov.name = imgbuf_addstr(&strtab, worker->provs[k].name);
+			imgprov.provider = nameoff[worker->provs[k].provider - worker->pairs];
+			imgprov.db = dbidx;
+			imgbuf_add(&provs, &imgprov, sizeof(imgprov));
+			hdr.nprovides++;
+		}
+	}
+
+	memcpy(hdr.magic, HASHDB_IMG_MAGIC, sizeof(hdr.magic));
+	hdr.version = HASHDB_IMG_VERSION;
+	hdr.strsz = strtab.len;
+
+	/* Write to a temporary file and rename, so a half written image is never
+	 * mapped */
+	hashdb_image_path(path, PATH_MAX);
+	snprintf(tmppath, PATH_MAX, "%s.XXXXXX", path);
+	fd = mkstemp(tmppath);
+	if (fd < 0) {
+		goto cleanup;
+	}
+
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		close(fd);
+		unlink(tmppath);
+		goto cleanup;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	fwrite(dbs.data, 1, dbs.len, fp);
+	fwrite(pkgs.data, 1, pkgs.len, fp);
+	fwrite(provs.data, 1, provs.len, fp);
+	fwrite(strtab.data, 1, strtab.len, fp);
+	ret = ferror(fp);
+
+	if (fclose(fp) || ret || rename(tmppath, path)) {
+		unlink(tmppath);
+	} else {
+		pw_printf(PW_LOG_DEBUG, "hashdb: saved image with %u packages\n", hdr.npkgs);
+	}
+
+cleanup:
+	free(nameoff);
+	free(dbs.data);
+	free(pkgs.data);
+	free(provs.data);
+	free(strtab.data);
+}
+
+/* Fills hashdb from a saved image if it is still valid.
+ * returns 0 on success, -1 if the image is missing or stale.
+ */
+static int hashdb_load_image(struct pw_hashdb *hashdb, alpm_db_t *localdb,
+							 alpm_list_t *syncdbs)
+{
+	const struct hashdb_img_hdr *hdr;
+	const struct hashdb_img_db *imgdbs;
+	const struct hashdb_img_pkg *imgpkgs;
+	const struct hashdb_img_prov *imgprovs;
+	const char *strtab;
+	alpm_db_t **dbs = NULL;
+	alpm_list_t *i;
+	struct pkgpair pkgpair;
+	struct stat st;
+	void *image, *pkgpair_ptr;
+	size_t sz;
+	uint32_t k, nlocal;
+	char path[PATH_MAX];
+	int fd;
+
+	hashdb_image_path(path, PATH_MAX);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (fstat(fd, &st) || st.st_size < 0 ||
+		(size_t) st.st_size < sizeof(struct hashdb_img_hdr)) {
+		close(fd);
+		return -1;
+	}
+
+	sz = st.st_size;
+	image = mmap(NULL, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) {
+		return -1;
+	}
+
+	hdr = image;
+	if (memcmp(hdr->magic, HASHDB_IMG_MAGIC, sizeof(hdr->magic)) ||
+		hdr->version != HASHDB_IMG_VERSION ||
+		hdr->ndbs != alpm_list_count(syncdbs) + 1 ||
+		sz != sizeof(*hdr) + hdr->ndbs * sizeof(*imgdbs) +
+			  (size_t) hdr->npkgs * sizeof(*imgpkgs) +
+			  (size_t) hdr->nprovides * sizeof(*imgprovs) + hdr->strsz ||
+		hdr->strsz == 0) {
+		goto stale;
+	}
+
+	imgdbs = (const void *) (hdr + 1);
+	imgpkgs = (const void *) (imgdbs + hdr->ndbs);
+	imgprovs = (const void *) (imgpkgs + hdr->npkgs);
+	strtab = (const char *) (imgprovs + hdr->nprovides);
+
+	/* Every string must lie inside the string table */
+	if (strtab[hdr->strsz - 1] != 0) {
+		goto stale;
+	}
+
+	/* Same dbs, in the same order, untouched since the image was made */
+	dbs = xcalloc(hdr->ndbs, sizeof(alpm_db_t *));
+	dbs[0] = localdb;
+	for (i = syncdbs, k = 1; i; i = i->next, ++k) {
+		dbs[k] = i->data;
+	}
+
+	for (k = 0; k < hdr->ndbs; ++k) {
+		if (imgdbs[k].name >= hdr->strsz ||
+			strcmp(strtab + imgdbs[k].name, alpm_db_get_name(dbs[k])) ||
+			hashdb_db_stat(dbs[k], k == 0, &st) ||
+			imgdbs[k].mtime != st.st_mtim.tv_sec ||
+			imgdbs[k].mtime_nsec != st.st_mtim.tv_nsec ||
+			imgdbs[k].size != st.st_size) {
+			goto stale;
+		}
+	}
+
+	for (k = 0, nlocal = 0; k < hdr->npkgs; ++k) {
+		if (imgpkgs[k].name >= hdr->strsz || imgpkgs[k].db >= hdr->ndbs) {
+			goto stale;
+		}
+		if (imgpkgs[k].db == 0) {
+			++nlocal;
+		}
+	}
+
+	for (k = 0; k < hdr->nprovides; ++k) {
+		if (imgprovs[k].name >= hdr->strsz || imgprovs[k].provider >= hdr->strsz) {
+			goto stale;
 		}
 	}
+
+	/* Image is good, strings are used in place */
+	hash_reserve(hashdb->local, nlocal);
+	hash_reserve(hashdb->sync, hdr->npkgs - nlocal);
+	for (k = 0; k < hdr->npkgs; ++k) {
+		pkgpair.pkgname = intern(strtab + imgpkgs[k].name);
+		pkgpair.pkg = NULL;
+		pkgpair.db = dbs[imgpkgs[k].db];
+
+		pkgpair_ptr = arena_memdup(hashdb->pkgpool, &pkgpair, sizeof(struct pkgpair));
+		if (imgpkgs[k].db == 0) {
+			hash_insert(hashdb->local, pkgpair_ptr);
+			if (imgpkgs[k].flags & HASHDB_IMG_AUR) {
+				hash_insert(hashdb->aur, pkgpair_ptr);
+				hashmap_insert(hashdb->pkg_from, (void *) pkgpair.pkgname,
+							   &hashdb->pkg_from_aur);
+			}
+		} else {
+			hash_insert(hashdb->sync, pkgpair_ptr);
+		}
+	}
+
+	for (k = 0; k < hdr->nprovides; ++k) {
+		csrmap_add(imgprovs[k].db == 0 ? hashdb->local_provides :
+				   hashdb->sync_provides, (void *) intern(strtab + imgprovs[k].name),
+				   (void *) intern(strtab + imgprovs[k].provider));
+	}
+	csrmap_build(hashdb->local_provides);
+	csrmap_build(hashdb->sync_provides);
+
+	/* Names have all been interned, the image is no longer needed */
+	pw_printf(PW_LOG_DEBUG, "hashdb: loaded image with %u packages\n", hdr->npkgs);
+	free(dbs);
+	munmap(image, sz);
+	return 0;
+
+stale:
+	pw_printf(PW_LOG_DEBUG, "hashdb: image is stale, rebuilding\n");
+	free(dbs);
+	munmap(image, sz);
+	return -1;
 }
 
 struct pw_hashdb *build_hashdb(void)
 {
-	alpm_list_t *i, *k, *syncdbs, *dbcache;
-	alpm_db_t *db;
+	alpm_list_t *i, *syncdbs, *dbcache;
+	alpm_db_t *db, *localdb;
+	alpm_db_t **dbs;
 	alpm_pkg_t *pkg;
 
-	char buf[1024];
-	const char *pkgname;
-	char *dupstr;
+	int idx, ndbs;
+	unsigned int nsync;
+	struct hashdb_worker *workers;
 	struct pkgpair pkgpair;
-	void *memlist_ptr;
+	void *pkgpair_ptr;
 
 	struct pw_hashdb *hashdb = hashdb_new();
 
@@ -124,33 +644,71 @@ struct pw_hashdb *build_hashdb(void)
 		goto error_cleanup;
 	}
 
-	dbcache = alpm_db_get_pkgcache(db);
-	if (!dbcache) {
-		error(PW_ERR_LOCALDB_CACHE_NULL);
-		goto error_cleanup;
+	syncdbs = alpm_option_get_syncdbs(config->handle);
+	if (!hashdb_load_image(hashdb, db, syncdbs)) {
+		return hashdb;
 	}
 
-	hash_packages(dbcache, hashdb->local, hashdb->local_provides, hashdb);
+	localdb = db;
+	ndbs = alpm_list_count(syncdbs) + 1;
+	dbs = xcalloc(ndbs, sizeof(alpm_db_t *));
+	dbs[0] = localdb;
+	for (i = syncdbs, idx = 1; i; i = i->next, ++idx) {
+		dbs[idx] = i->data;
+	}
 
-	syncdbs = alpm_option_get_syncdbs(config->handle);
-	for (i = syncdbs; i; i = i->next) {
-		db = i->data;
-		hash_packages(alpm_db_get_pkgcache(db), hashdb->sync, hashdb->sync_provides,
-					  hashdb);
+	workers = hash_databases(dbs, ndbs);
+	free(dbs);
+
+	for (idx = 1, nsync = 0; idx < ndbs; ++idx) {
+		nsync += workers[idx].npkgs;
+	}
+	hash_reserve(hashdb->sync, nsync);
+
+	/* Merge in db order so that the first sync db providing a package
+	 * still wins, as it would if the dbs were hashed one after another.
+	 */
+	for (idx = 0; idx < ndbs; ++idx) {
+		if (idx == 0) {
+			hashdb_worker_intern(&workers[idx], hashdb->local_provides);
+			hash_free(hashdb->local);
+			hashdb->local = workers[idx].pkgs;
+		} else {
+			hashdb_worker_intern(&workers[idx], hashdb->sync_provides);
+			hash_merge(hashdb->sync, workers[idx].pkgs);
+			hash_free(workers[idx].pkgs);
+		}
+
+		arena_splice(hashdb->pkgpool, workers[idx].pkgpool);
+	}
+
+	dbcache = workers[0].dbcache;
+
+	csrmap_build(hashdb->local_provides);
+	csrmap_build(hashdb->sync_provides);
+
+	if (!dbcache) {
+		error(PW_ERR_LOCALDB_CACHE_NULL);
+		hashdb_workers_free(workers, ndbs);
+		goto error_cleanup;
 	}
 
 	/* Compute AUR packages */
 	for (i = dbcache; i; i = i->next) {
 		pkg = i->data;
-		pkgpair.pkgname = alpm_pkg_get_name(pkg);
+		pkgpair.pkgname = intern(alpm_pkg_get_name(pkg));
 		pkgpair.pkg = pkg;
+		pkgpair.db = localdb;
 		if (!hash_search(hashdb->sync, &pkgpair)) {
-			memlist_ptr = memlist_add(hashdb->pkgpool, &pkgpair);
-			hash_insert(hashdb->aur, memlist_ptr);
+			pkgpair_ptr = arena_memdup(hashdb->pkgpool, &pkgpair,
+									   sizeof(struct pkgpair));
+			hash_insert(hashdb->aur, pkgpair_ptr);
 			hashmap_insert(hashdb->pkg_from, (void *) pkgpair.pkgname, &hashdb->pkg_from_aur);
 		}
 	}
 
+	hashdb_save_image(hashdb, workers, ndbs);
+	hashdb_workers_free(workers, ndbs);
 	return hashdb;
 
 error_cleanup:
@@ -158,10 +716,19 @@ error_cleanup:
 	return NULL;
 }
 
-unsigned long pkgpair_sdbm(void *pkg)
+alpm_pkg_t *pkgpair_get_pkg(struct pkgpair *pair)
+{
+	if (!pair->pkg && pair->db) {
+		pair->pkg = alpm_db_get_pkg(pair->db, pair->pkgname);
+	}
+
+	return pair->pkg;
+}
+
+unsigned long pkgpair_hash(void *pkg)
 {
 	const struct pkgpair *pair = pkg;
-	return sdbm(pair->pkgname);
+	return pw_strhash(pair->pkgname);
 }
 
 int pkgpair_cmp(const void *a, const void *b)
@@ -173,7 +740,7 @@ int pkgpair_cmp(const void *a, const void *b)
 
 	const struct pkgpair *pair1 = a;
 	const struct pkgpair *pair2 = b;
-	return strcmp(pair1->pkgname, pair2->pkgname);
+	return intern_cmp(pair1->pkgname, pair2->pkgname);
 }
 
 void *provides_search(void *htable, void *val)
@@ -1,10 +1,11 @@
 #ifndef POWAUR_HASHDB_H
 #define POWAUR_HASHDB_H
 
+#include <alpm.h>
 #include <alpm_list.h>
 
+#include "arena.h"
 #include "hash.h"
-#include "memlist.h"
 #include "powaur.h"
 
 /* Used for dependency resolution */
@@ -19,8 +20,9 @@ struct pw_hashdb {
 	struct hash_table *aur_outdated;
 	alpm_list_t *immediate_deps;
 
-	struct hashbst *local_provides;
-	struct hashbst *sync_provides;
+	/* provided name -> sorted providing package names */
+	struct csrmap *local_provides;
+	struct csrmap *sync_provides;
 
 	/* Cache provided->providing key-value mapping */
 	struct hashmap *provides_cache;
@@ -30,9 +32,8 @@ struct pw_hashdb {
 	 */
 	struct hashmap *pkg_from;
 
-	/* Backing store for strings and pkgpair */
-	struct memlist *strpool;
-	struct memlist *pkgpool;
+	/* Backing store for pkgpair, names are interned */
+	struct arena *pkgpool;
 
 	/* Constant stuff */
 	enum pkgfrom_t pkg_from_unknown;
@@ -45,17 +46,24 @@ struct pw_hashdb *hashdb_new(void);
 void hashdb_free(struct pw_hashdb *hashdb);
 struct pw_hashdb *build_hashdb(void);
 
-/* Used for hashing, pkg can be alpm_pkg_t or aurpkg_t */
+/* Used for hashing, pkg can be alpm_pkg_t or aurpkg_t.
+ * Pairs loaded from a hashdb image only know their db, use pkgpair_get_pkg.
+ */
 struct pkgpair {
 	const char *pkgname;
 	void *pkg;
+	alpm_db_t *db;
 };
 
-unsigned long pkgpair_sdbm(void *pkg);
+/* returns the alpm_pkg_t * of a local / sync pkgpair, looking it up in its
+ * db if need be */
+alpm_pkg_t *pkgpair_get_pkg(struct pkgpair *pair);
+
+unsigned long pkgpair_hash(void *pkg);
 int pkgpair_cmp(const void *a, const void *b);
 
 /* Searches htable for given package val
- * Provided to hashbst_tree_search */
+ * Provided to csrmap_find */
 void *provides_search(void *htable, void *val);
 
 #endif
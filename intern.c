@@ -0,0 +1,91 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "conf.h"
+#include "environment.h"
+#include "hash.h"
+#include "intern.h"
+#include "util.h"
+#include "wrapper.h"
+
+/* Strings are packed into chunks of this size */
+#define INTERN_CHUNK_SZ 65536
+
+static struct {
+	pthread_mutex_t lock;
+	struct hash_table *strings;
+	struct arena *pool;
+} interner = { PTHREAD_MUTEX_INITIALIZER, NULL, NULL };
+
+const char *intern(const char *str)
+{
+	const char *ret;
+
+	if (!str) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&interner.lock);
+	if (!interner.strings) {
+		interner.strings = hash_new(HASH_TABLE, (pw_hash_fn) pw_strhash,
+									(pw_hashcmp_fn) strcmp);
+		interner.pool = arena_new(INTERN_CHUNK_SZ);
+	}
+
+	ret = hash_search(interner.strings, (void *) str);
+	if (!ret) {
+		ret = arena_strdup(interner.pool, str);
+		hash_insert(interner.strings, (void *) ret);
+	}
+	pthread_mutex_unlock(&interner.lock);
+
+	return ret;
+}
+
+const char *intern_lookup(const char *str)
+{
+	const char *ret = NULL;
+
+	if (!str) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&interner.lock);
+	if (interner.strings) {
+		ret = hash_search(interner.strings, (void *) str);
+	}
+	pthread_mutex_unlock(&interner.lock);
+
+	return ret;
+}
+
+int intern_cmp(const void *a, const void *b)
+{
+	if (a == b) {
+		return 0;
+	}
+
+	return strcmp(a, b);
+}
+
+void intern_cleanup(void)
+{
+	size_t used, total;
+
+	pthread_mutex_lock(&interner.lock);
+	if (interner.strings) {
+		if (config->loglvl & PW_LOG_DEBUG) {
+			hash_stats(interner.strings, "interned", PW_LOG_DEBUG);
+			arena_usage(interner.pool, &used, &total);
+			pw_printf(PW_LOG_DEBUG, "interned: %zu of %zu bytes used\n",
+					  used, total);
+		}
+		hash_free(interner.strings);
+		arena_free(interner.pool);
+		interner.strings = NULL;
+		interner.pool = NULL;
+	}
+	pthread_mutex_unlock(&interner.lock);
+}
@@ -0,0 +1,27 @@
+#ifndef POWAUR_INTERN_H
+#define POWAUR_INTERN_H
+
+/* Process wide string interner for package and provide names.
+ *
+ * intern returns one canonical copy per distinct string, which stays valid
+ * until intern_cleanup. Tables keyed on interned names use intern_cmp, so a
+ * hit costs a pointer comparison. Keys which were not interned still compare
+ * correctly, through strcmp.
+ *
+ * Safe to call from several threads, but every call takes one lock. Bulk
+ * interning from worker threads belongs on the thread that joins them.
+ */
+
+/* returns the canonical copy of str, NULL if str is NULL */
+const char *intern(const char *str);
+
+/* returns the canonical copy of str if it has been interned, NULL otherwise */
+const char *intern_lookup(const char *str);
+
+/* strcmp with a pointer equality fast path, for use as a pw_hashcmp_fn */
+int intern_cmp(const void *a, const void *b);
+
+/* Frees every interned string */
+void intern_cleanup(void);
+
+#endif
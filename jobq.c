@@ -0,0 +1,108 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "jobq.h"
+#include "wrapper.h"
+
+struct jobq_node {
+	void *job;
+	struct jobq_node *next;
+};
+
+struct jobq {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	struct jobq_node *head;
+	struct jobq_node *tail;
+
+	/* Jobs pushed but not yet marked done */
+	unsigned int pending;
+	int shutdown;
+};
+
+struct jobq *jobq_new(void)
+{
+	struct jobq *q = xcalloc(1, sizeof(struct jobq));
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	return q;
+}
+
+void jobq_free(struct jobq *q)
+{
+	struct jobq_node *node, *next;
+	if (!q) {
+		return;
+	}
+
+	for (node = q->head; node; node = next) {
+		next = node->next;
+		free(node);
+	}
+
+	pthread_cond_destroy(&q->cond);
+	pthread_mutex_destroy(&q->lock);
+	free(q);
+}
+
+void jobq_push(struct jobq *q, void *job)
+{
+	struct jobq_node *node = xcalloc(1, sizeof(struct jobq_node));
+	node->job = job;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->tail) {
+		q->tail->next = node;
+	} else {
+		q->head = node;
+	}
+
+	q->tail = node;
+	q->pending++;
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+void *jobq_pop(struct jobq *q)
+{
+	struct jobq_node *node;
+	void *job = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	while (!q->head && q->pending && !q->shutdown) {
+		pthread_cond_wait(&q->cond, &q->lock);
+	}
+
+	if (q->head && !q->shutdown) {
+		node = q->head;
+		q->head = node->next;
+		if (!q->head) {
+			q->tail = NULL;
+		}
+
+		job = node->job;
+		free(node);
+	}
+
+	pthread_mutex_unlock(&q->lock);
+	return job;
+}
+
+void jobq_done(struct jobq *q)
+{
+	pthread_mutex_lock(&q->lock);
+	/* Last job out wakes everyone so they can exit */
+	if (--q->pending == 0) {
+		pthread_cond_broadcast(&q->cond);
+	}
+	pthread_mutex_unlock(&q->lock);
+}
+
+void jobq_shutdown(struct jobq *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->shutdown = 1;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
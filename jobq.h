@@ -0,0 +1,35 @@
+#ifndef POWAUR_JOBQ_H
+#define POWAUR_JOBQ_H
+
+/* Multi producer, multi consumer job queue shared by worker threads.
+ *
+ * Every job pushed is counted as pending until a worker marks it done with
+ * jobq_done. Workers may push new jobs while handling one, so a queue only
+ * runs dry once it is empty and nothing is pending.
+ */
+
+struct jobq;
+
+struct jobq *jobq_new(void);
+void jobq_free(struct jobq *q);
+
+/* Adds a job to the back of the queue */
+void jobq_push(struct jobq *q, void *job);
+
+/* Takes a job from the front of the queue, blocking while the queue is empty
+ * but other jobs are still pending.
+ *
+ * returns the job, or NULL when there is no more work or the queue has been
+ * shut down.
+ */
+void *jobq_pop(struct jobq *q);
+
+/* Marks a job obtained from jobq_pop as finished */
+void jobq_done(struct jobq *q);
+
+/* Wakes up all waiting workers, jobq_pop returns NULL from now on.
+ * Jobs still in the queue are left for the caller to free.
+ */
+void jobq_shutdown(struct jobq *q);
+
+#endif
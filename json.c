@@ -3,23 +3,26 @@
 
 #include <yajl/yajl_parse.h>
 
+#include "arena.h"
+#include "cache.h"
 #include "curl.h"
 #include "environment.h"
 #include "error.h"
-#include "handle.h"
 #include "json.h"
 #include "powaur.h"
 #include "query.h"
+#include "rpc.h"
 #include "util.h"
+#include "wrapper.h"
 
-static yajl_handle yajl_init(void)
+yajl_handle yajl_init(struct json_ctx_t *ctx)
 {
 	/* Reset the json_ctx */
-	pwhandle->json_ctx->pkglist = NULL;
-	pwhandle->json_ctx->curpkg = NULL;
-	pwhandle->json_ctx->jsondepth = 0;
+	ctx->pkgs = aurpkg_set_new();
+	ctx->curpkg = NULL;
+	ctx->jsondepth = 0;
 
-	yajl_handle yajl_hand = yajl_alloc(yajl_cbs, NULL, pwhandle->json_ctx);
+	yajl_handle yajl_hand = yajl_alloc(yajl_cbs, NULL, ctx);
 	if (!yajl_hand) {
 		die_errno(PW_ERR_MEMORY);
 	}
@@ -27,59 +30,230 @@ static yajl_handle yajl_init(void)
 	return yajl_hand;
 }
 
-/* Issues a query to AUR.
- * @param pkgname package to query
- * @param type type of query: info, search, msearch
- * returns an alpm_list_t * of packages if everything is ok,
+void json_ctx_cleanup(struct json_ctx_t *ctx)
+{
+	aurpkg_set_free(ctx->pkgs);
+	ctx->curpkg = NULL;
+	ctx->pkgs = NULL;
+}
+
+struct aurpkg_set *json_ctx_results(struct json_ctx_t *ctx)
+{
+	struct aurpkg_set *pkgs = ctx->pkgs;
+
+	/* The half parsed package is always the last one */
+	if (ctx->curpkg) {
+		aurpkg_set_pop(pkgs);
+		ctx->curpkg = NULL;
+	}
+
+	ctx->pkgs = NULL;
+	if (!pkgs->nr) {
+		aurpkg_set_free(pkgs);
+		return NULL;
+	}
+
+	return pkgs;
+}
+
+struct aurpkg_set *parse_json_buf(const char *data, size_t len)
+{
+	struct json_ctx_t json_ctx;
+	yajl_handle hand;
+
+	hand = yajl_init(&json_ctx);
+	yajl_parse(hand, (const unsigned char *) data, len);
+	yajl_complete_parse(hand);
+	yajl_free(hand);
+
+	return json_ctx_results(&json_ctx);
+}
+
+/* Performs a single request to the AUR RPC interface.
+ * The raw response is stored in resp for the RPC cache. Anything but a
+ * 200 response is an error, with pwerrno set.
+ * returns the set of packages if everything is ok,
  * otherwise, returns NULL.
  */
-alpm_list_t *query_aur(CURL *curl, const char *searchstr, enum aurquery_t query_type)
+static struct aurpkg_set *aur_rpc_request(CURL *curl, const char *url,
+									struct json_resp *resp)
 {
-	int ret = 0;
-	yajl_handle hand;
-	char url[PATH_MAX];
-	long httpresp;
+	struct json_ctx_t json_ctx;
+	CURLcode curlret;
+	long httpresp = 0;
 
-	hand = yajl_init();
+	resp->hand = yajl_init(&json_ctx);
 
 	/* Query AUR */
 	curl_reset(curl);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, parse_json);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, hand);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, parse_json_resp);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, resp);
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+
+	curlret = curl_easy_perform(curl);
+	curl_stats_update(curl);
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpresp);
+
+	/* Error pages come back with CURLE_OK, they must not reach the cache */
+	if (curlret != CURLE_OK || httpresp != 200) {
+		yajl_free(resp->hand);
+		json_ctx_cleanup(&json_ctx);
+
+		if (httpresp != 200) {
+			pw_fprintf(PW_LOG_ERROR, stderr, "curl responded with http code %ld\n",
+					   httpresp);
+		}
+
+		RET_ERR(PW_ERR_CURL_DOWNLOAD, NULL);
+	}
+
+	yajl_complete_parse(resp->hand);
+	yajl_free(resp->hand);
+
+	return json_ctx_results(&json_ctx);
+}
+
+void aur_rpc_url(char *url, size_t sz, enum aurquery_t query_type, const char *arg)
+{
+	size_t len;
 
 	switch (query_type) {
 	case AUR_QUERY_SEARCH:
-		snprintf(url, PATH_MAX, AUR_RPC_URL, AUR_RPC_TYPE_SEARCH, searchstr);
+		snprintf(url, sz, AUR_RPC_URL, powaur_aur_url, AUR_RPC_TYPE_SEARCH, arg);
 		break;
 
 	case AUR_QUERY_INFO:
-		snprintf(url, PATH_MAX, AUR_RPC_URL, AUR_RPC_TYPE_INFO, searchstr);
+		snprintf(url, sz, AUR_RPC_URL, powaur_aur_url, AUR_RPC_TYPE_INFO, arg);
 		break;
 
 	case AUR_QUERY_MSEARCH:
-		snprintf(url, PATH_MAX, AUR_RPC_URL, AUR_RPC_TYPE_MSEARCH, searchstr);
+		snprintf(url, sz, AUR_RPC_URL, powaur_aur_url, AUR_RPC_TYPE_MSEARCH, arg);
+		break;
+
+	case AUR_QUERY_MULTIINFO:
+		len = snprintf(url, sz, AUR_RPC_MINFO_URL, powaur_aur_url);
+		if (len < sz) {
+			snprintf(url + len, sz - len, "%s", arg);
+		}
 		break;
 
 	default:
+		url[0] = 0;
 		break;
 	}
+}
 
-	curl_easy_setopt(curl, CURLOPT_URL, url);
-	if (curl_easy_perform(curl) != CURLE_OK) {
-		yajl_free(hand);
+/* Issues a query to AUR.
+ * @param pkgname package to query
+ * @param type type of query: info, search, msearch
+ * returns the set of packages if everything is ok,
+ * otherwise, returns NULL.
+ */
+struct aurpkg_set *query_aur(CURL *curl, const char *searchstr,
+							 enum aurquery_t query_type)
+{
+	char url[PATH_MAX];
+	char *data;
+	size_t len;
+	struct aurpkg_set *results;
+	struct json_resp resp;
 
-		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpresp);
-		if (httpresp != 200) {
-			pw_fprintf(PW_LOG_ERROR, stderr, "curl responded with http code %ld",
-					   httpresp);
+	/* Served from the RPC cache if we asked recently */
+	data = rpc_cache_get(query_type, searchstr, &len);
+	if (data) {
+		results = parse_json_buf(data, len);
+		free(data);
+		return results;
+	}
+
+	memset(&resp, 0, sizeof(struct json_resp));
+	aur_rpc_url(url, PATH_MAX, query_type, searchstr);
+
+	CLEAR_ERRNO();
+	results = aur_rpc_request(curl, url, &resp);
+
+	if (pwerrno == PW_ERR_OK && resp.len) {
+		rpc_cache_put(query_type, searchstr, resp.raw, resp.len);
+	}
+
+	free(resp.raw);
+	return results;
+}
+
+/* aur_rpc callback for multiinfo, merges results into the set in userdata */
+static void multiinfo_done(const char *arg, struct aurpkg_set *results,
+						   void *userdata)
+{
+	if (results) {
+		aurpkg_set_merge(userdata, results);
+	}
+}
+
+struct aurpkg_set *query_aur_multiinfo(CURL *curl, alpm_list_t *pkgnames,
+									   struct hashmap **table)
+{
+	alpm_list_t *i;
+	struct aurpkg_set *results = aurpkg_set_new();
+	struct aur_rpc *rpc;
+	struct aurpkg_t *pkg;
+	unsigned int idx;
+	char args[AUR_RPC_MAX_URL_LEN];
+	char *escaped;
+	size_t len, baselen, arglen;
+
+	/* Every batch is sent concurrently */
+	rpc = aur_rpc_new(config->maxthreads);
+	baselen = snprintf(args, sizeof(args), AUR_RPC_MINFO_URL, powaur_aur_url);
+	len = 0;
+
+	for (i = pkgnames; i; i = i->next) {
+		escaped = curl_easy_escape(curl, i->data, 0);
+		if (!escaped) {
+			continue;
 		}
 
-		RET_ERR(PW_ERR_CURL_DOWNLOAD, NULL);
+		arglen = strlen(AUR_RPC_MINFO_ARG) + strlen(escaped);
+		if (baselen + arglen >= AUR_RPC_MAX_URL_LEN) {
+			pw_fprintf(PW_LOG_ERROR, stderr, "Package name too long: %s\n",
+					   i->data);
+			curl_free(escaped);
+			continue;
+		}
+
+		/* Start a new batch if this argument does not fit */
+		if (baselen + len + arglen >= AUR_RPC_MAX_URL_LEN) {
+			aur_rpc_add(rpc, AUR_QUERY_MULTIINFO, args, multiinfo_done, results);
+			len = 0;
+		}
+
+		len += snprintf(args + len, sizeof(args) - len, "%s%s",
+						AUR_RPC_MINFO_ARG, escaped);
+		curl_free(escaped);
 	}
 
-	yajl_complete_parse(hand);
-	yajl_free(hand);
-	return pwhandle->json_ctx->pkglist;
+	if (len) {
+		aur_rpc_add(rpc, AUR_QUERY_MULTIINFO, args, multiinfo_done, results);
+	}
+
+	aur_rpc_run(rpc);
+	aur_rpc_free(rpc);
+
+	pw_printf(PW_LOG_DEBUG, "multiinfo: %zu packages requested, %u found\n",
+			  alpm_list_count(pkgnames), results->nr);
+
+	/* The set is complete, so pointers into it stay valid from here on */
+	if (table) {
+		*table = hashmap_new((pw_hash_fn) pw_strhash, (pw_hashcmp_fn) strcmp);
+		hashmap_reserve(*table, results->nr);
+		for (idx = 0; idx < results->nr; ++idx) {
+			pkg = results->pkgs + idx;
+			if (pkg->name) {
+				hashmap_insert(*table, pkg->name, pkg);
+			}
+		}
+	}
+
+	return results;
 }
 
 /* yajl callback functions */
@@ -92,21 +266,21 @@ static int json_string(void *ctx, const unsigned char *ukey, size_t len)
 		strncmp(key, "error", 5) == 0) {
 		return 1;
 	} else if (strcmp(parser->curkey, "ID") == 0) {
-		parser->curpkg->id = strndup(key, len);
+		parser->curpkg->id = arena_strndup(parser->pkgs->pool, key, len);
 	} else if (strcmp(parser->curkey, "Name") == 0) {
-		parser->curpkg->name = strndup(key, len);
+		parser->curpkg->name = arena_strndup(parser->pkgs->pool, key, len);
 	} else if (strcmp(parser->curkey, "Version") == 0) {
-		parser->curpkg->version = strndup(key, len);
+		parser->curpkg->version = arena_strndup(parser->pkgs->pool, key, len);
 	} else if (strcmp(parser->curkey, "CategoryID") == 0) {
-		parser->curpkg->category = strndup(key, len);
+		parser->curpkg->category = arena_strndup(parser->pkgs->pool, key, len);
 	} else if (strcmp(parser->curkey, "Description") == 0) {
-		parser->curpkg->desc = strndup(key, len);
+		parser->curpkg->desc = arena_strndup(parser->pkgs->pool, key, len);
 	} else if (strcmp(parser->curkey, "URL") == 0) {
-		parser->curpkg->url = strndup(key, len);
+		parser->curpkg->url = arena_strndup(parser->pkgs->pool, key, len);
 	} else if (strcmp(parser->curkey, "URLPath") == 0) {
-		parser->curpkg->urlpath = strndup(key, len);
+		parser->curpkg->urlpath = arena_strndup(parser->pkgs->pool, key, len);
 	} else if (strcmp(parser->curkey, "License") == 0) {
-		parser->curpkg->license = strndup(key, len);
+		parser->curpkg->license = arena_strndup(parser->pkgs->pool, key, len);
 	} else if (strcmp(parser->curkey, "NumVotes") == 0) {
 		parser->curpkg->votes = atoi(key);
 	} else if (strcmp(parser->curkey, "OutOfDate") == 0) {
@@ -120,7 +294,7 @@ static int json_start_map(void *ctx)
 {
 	struct json_ctx_t *parser = ctx;
 	if (parser->jsondepth++ > 0) {
-		parser->curpkg = aurpkg_new();
+		parser->curpkg = aurpkg_set_add(parser->pkgs);
 	}
 
 	return 1;
@@ -139,7 +313,6 @@ static int json_end_map(void *ctx)
 {
 	struct json_ctx_t *parser = ctx;
 	if (--parser->jsondepth > 0) {
-		parser->pkglist = alpm_list_add(parser->pkglist, parser->curpkg);
 		parser->curpkg = NULL;
 	}
 
@@ -164,6 +337,24 @@ yajl_callbacks yajl_cbs[] = {
 };
 
 
+size_t parse_json_resp(void *ptr, size_t sz, size_t nmemb, void *userdata)
+{
+	struct json_resp *resp = userdata;
+	size_t totalsz = sz * nmemb;
+
+	if (resp->len + totalsz > resp->cap) {
+		resp->cap = resp->len + totalsz > 2 * resp->cap ?
+			resp->len + totalsz : 2 * resp->cap;
+		resp->raw = xrealloc(resp->raw, resp->cap);
+	}
+
+	memcpy(resp->raw + resp->len, ptr, totalsz);
+	resp->len += totalsz;
+
+	yajl_parse(resp->hand, ptr, totalsz);
+	return totalsz;
+}
+
 /* curl WRITEDATA function */
 size_t parse_json(void *ptr, size_t sz, size_t nmemb, void *userdata)
 {
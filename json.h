@@ -5,6 +5,7 @@
 #include <curl/curl.h>
 #include <yajl/yajl_parse.h>
 
+#include "hash.h"
 #include "query.h"
 #include "package.h"
 
@@ -12,21 +13,76 @@
 
 /* This is the void *ctx passed into yajl_alloc(), which is in turn
  * passed to the yajl_callbacks when yajl_parse() is called.
+ * Every request owns its own context so that queries may run in parallel.
  */
 
 struct json_ctx_t {
-	alpm_list_t *pkglist;
+	struct aurpkg_set *pkgs;
 	struct aurpkg_t *curpkg;
 	char curkey[JSON_KEY_LEN];
 	int jsondepth;
 };
 
-/* Query functions */
-alpm_list_t *query_aur(CURL *curl, const char *pkgname, enum aurquery_t type);
+/* A response being received. It is parsed as it arrives and kept in raw form
+ * for the RPC cache.
+ */
+struct json_resp {
+	yajl_handle hand;
+	char *raw;
+	size_t len;
+	size_t cap;
+};
+
+/* Resets ctx and returns a yajl handle which parses into it.
+ * The handle is to be freed with yajl_free.
+ */
+yajl_handle yajl_init(struct json_ctx_t *ctx);
+
+/* Frees the packages held by ctx */
+void json_ctx_cleanup(struct json_ctx_t *ctx);
+
+/* Takes the packages parsed into ctx, dropping any half parsed one.
+ * returns NULL if there are none.
+ */
+struct aurpkg_set *json_ctx_results(struct json_ctx_t *ctx);
+
+/* Writes the RPC url for a query into url.
+ * For AUR_QUERY_MULTIINFO, arg is a string of pre-escaped AUR_RPC_MINFO_ARG
+ * arguments.
+ */
+void aur_rpc_url(char *url, size_t sz, enum aurquery_t type, const char *arg);
+
+/* Query functions.
+ * returns the set of packages found, NULL if there are none.
+ */
+struct aurpkg_set *query_aur(CURL *curl, const char *pkgname, enum aurquery_t type);
+
+/* Issues batched info queries to AUR for a list of package names.
+ * The names are packed into as few multiinfo requests as the URL length
+ * limit allows.
+ *
+ * returns the set of packages found, to be freed by the caller with
+ * aurpkg_set_free. It is empty rather than NULL if nothing was found.
+ *
+ * @param curl curl easy handle
+ * @param pkgnames list of package names
+ * @param table if not NULL, set to a hashmap of pkgname -> struct aurpkg_t *
+ *        to be freed by the caller with hashmap_free
+ */
+struct aurpkg_set *query_aur_multiinfo(CURL *curl, alpm_list_t *pkgnames,
+									   struct hashmap **table);
 
 /* curl WRITEDATA function */
 size_t parse_json(void *ptr, size_t sz, size_t nmemb, void *userdata);
 
+/* curl WRITEFUNCTION, userdata is a struct json_resp * */
+size_t parse_json_resp(void *ptr, size_t sz, size_t nmemb, void *userdata);
+
+/* Parses a complete response.
+ * returns the set of packages in it, NULL if there are none.
+ */
+struct aurpkg_set *parse_json_buf(const char *data, size_t len);
+
 extern yajl_callbacks yajl_cbs[];
 
 #endif
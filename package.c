@@ -8,6 +8,7 @@
 
 #include <alpm.h>
 
+#include "arena.h"
 #include "environment.h"
 #include "hash.h"
 #include "hashdb.h"
@@ -16,36 +17,18 @@
 #include "util.h"
 #include "wrapper.h"
 
-struct aurpkg_t *aurpkg_new(void)
-{
-	struct aurpkg_t *pkg;
-	pkg = xcalloc(1, sizeof(struct aurpkg_t));
-	return pkg;
-}
+/* Initial number of packages in a set, and its arena chunk size */
+#define AURPKG_SET_INIT_SZ 16
+#define AURPKG_SET_POOL_CHUNK 32768
 
-void aurpkg_free(struct aurpkg_t *pkg)
+void aurpkg_free_lists(struct aurpkg_t *pkg)
 {
-	if (!pkg) {
-		return;
-	}
-
-	free(pkg->id);
-	free(pkg->name);
-	free(pkg->version);
-	free(pkg->category);
-	free(pkg->desc);
-	free(pkg->url);
-	free(pkg->urlpath);
-	free(pkg->license);
-
 	FREELIST(pkg->arch);
 	FREELIST(pkg->conflicts);
 	FREELIST(pkg->provides);
 	FREELIST(pkg->depends);
 	FREELIST(pkg->optdepends);
 	FREELIST(pkg->replaces);
-
-	free(pkg);
 }
 
 int aurpkg_name_cmp(const void *a, const void *b)
@@ -56,8 +39,81 @@ int aurpkg_name_cmp(const void *a, const void *b)
 
 int aurpkg_vote_cmp(const void *a, const void *b)
 {
-	return ((const struct aurpkg_t *)b)->votes -
-		   ((const struct aurpkg_t *)a)->votes;
+	int diff = ((const struct aurpkg_t *)b)->votes -
+			   ((const struct aurpkg_t *)a)->votes;
+
+	return diff ? diff : aurpkg_name_cmp(a, b);
+}
+
+struct aurpkg_set *aurpkg_set_new(void)
+{
+	struct aurpkg_set *set = xcalloc(1, sizeof(struct aurpkg_set));
+	set->pool = arena_new(AURPKG_SET_POOL_CHUNK);
+	return set;
+}
+
+void aurpkg_set_free(struct aurpkg_set *set)
+{
+	if (!set) {
+		return;
+	}
+
+	arena_free(set->pool);
+	free(set->pkgs);
+	free(set);
+}
+
+static void aurpkg_set_reserve(struct aurpkg_set *set, unsigned int nr)
+{
+	unsigned int new_size;
+
+	if (nr <= set->sz) {
+		return;
+	}
+
+	new_size = set->sz ? set->sz : AURPKG_SET_INIT_SZ;
+	while (new_size < nr) {
+		new_size *= 2;
+	}
+
+	set->pkgs = xrealloc(set->pkgs, new_size * sizeof(struct aurpkg_t));
+	set->sz = new_size;
+}
+
+struct aurpkg_t *aurpkg_set_add(struct aurpkg_set *set)
+{
+	struct aurpkg_t *pkg;
+
+	aurpkg_set_reserve(set, set->nr + 1);
+	pkg = set->pkgs + set->nr++;
+	memset(pkg, 0, sizeof(struct aurpkg_t));
+	return pkg;
+}
+
+void aurpkg_set_pop(struct aurpkg_set *set)
+{
+	if (set->nr) {
+		set->nr--;
+	}
+}
+
+void aurpkg_set_merge(struct aurpkg_set *dst, struct aurpkg_set *src)
+{
+	aurpkg_set_reserve(dst, dst->nr + src->nr);
+	memcpy(dst->pkgs + dst->nr, src->pkgs, src->nr * sizeof(struct aurpkg_t));
+	dst->nr += src->nr;
+
+	/* The strings go along with the chunks holding them */
+	arena_splice(dst->pool, src->pool);
+	free(src->pkgs);
+	free(src);
+}
+
+void aurpkg_set_sort(struct aurpkg_set *set, int (*cmp) (const void *, const void *))
+{
+	if (set->nr > 1) {
+		qsort(set->pkgs, set->nr, sizeof(struct aurpkg_t), cmp);
+	}
 }
 
 /*
@@ -193,7 +249,7 @@ static void parse_bash_array(alpm_list_t **list, FILE *fp,
 	int can_break = 0;
 	char *token, *saveptr;
 	char *tmpstr;
-	static char buffer[PATH_MAX];
+	char buffer[PATH_MAX];
 
 	/* Parse multi-line bash array */
 	for (; !feof(fp) && !can_break; line = fgets(buf, PATH_MAX, fp)) {
@@ -328,7 +384,6 @@ alpm_list_t *grab_dependencies(const char *pkgbuild)
 	char buf[PATH_MAX];
 	char nbuf[PATH_MAX];
 	char *line, *p, *var, *x, *y;
-	void *key, *val;
 	size_t len;
 
 	fp = fopen(pkgbuild, "r");
@@ -341,9 +396,9 @@ alpm_list_t *grab_dependencies(const char *pkgbuild)
 	 * Build hash table of bash variables because
 	 * some bash variables can appear inside depends
 	 */
-	struct hashmap *hash = hashmap_new((pw_hash_fn) sdbm,
+	struct hashmap *hash = hashmap_new((pw_hash_fn) pw_strhash,
 									   (pw_hashcmp_fn) strcmp);
-	struct memlist *strpool = memlist_new(1024, sizeof(char *), MEMLIST_PTR);
+	struct arena *strpool = arena_new(PATH_MAX * 4);
 	while (line = fgets(buf, PATH_MAX, fp)) {
 		line = strtrim(line);
 		len = strlen(line);
@@ -364,11 +419,9 @@ alpm_list_t *grab_dependencies(const char *pkgbuild)
 			/* Substitute variables after '=' */
 			strncpy(nbuf, p, PATH_MAX);
 			substitute_vars(nbuf, hash, PATH_MAX-1);
-			x = xstrdup(line);
-			y = xstrdup(nbuf);
-			void *key = memlist_add(strpool, &x);
-			void *val = memlist_add(strpool, &y);
-			hashmap_insert(hash, key, val);
+			x = arena_strdup(strpool, line);
+			y = arena_strdup(strpool, nbuf);
+			hashmap_insert(hash, x, y);
 			continue;
 		}
 
@@ -378,104 +431,100 @@ alpm_list_t *grab_dependencies(const char *pkgbuild)
 		break;
 	}
 
-	memlist_free(strpool);
+	arena_free(strpool);
 	hashmap_free(hash);
 	fclose(fp);
 	return ret;
 }
 
-alpm_list_t *resolve_dependencies(struct pw_hashdb *hashdb, alpm_list_t *packages)
+alpm_list_t *resolve_pkg_dependencies(struct pw_hashdb *hashdb, const char *pkgname)
 {
-	alpm_list_t *i, *k, *m, *q;
+	alpm_list_t *k;
 	alpm_list_t *deps, *newdeps;
 
-	alpm_pkg_t *pkg;
 	struct pkgpair pkgpair;
 	struct pkgpair *pkgpair_ptr;
 	char pkgbuild[PATH_MAX];
 	struct stat st;
 
 	newdeps = NULL;
-	for (i = packages; i; i = i->next) {
-		snprintf(pkgbuild, PATH_MAX, "%s/PKGBUILD", i->data);
-		/* Grab the list of new dependencies from PKGBUILD */
-		deps = grab_dependencies(pkgbuild);
-		if (!deps) {
-			continue;
-		}
-
-		if (config->verbose) {
-			printf("\nResolving dependencies for %s\n", i->data);
-		}
+	snprintf(pkgbuild, PATH_MAX, "%s/PKGBUILD", pkgname);
+	/* Grab the list of new dependencies from PKGBUILD */
+	deps = grab_dependencies(pkgbuild);
+	if (!deps) {
+		return NULL;
+	}
 
-		for (k = deps; k; k = k->next) {
-			pkgpair.pkgname = k->data;
+	if (config->verbose) {
+		printf("\nResolving dependencies for %s\n", pkgname);
+	}
 
-			/* Check against newdeps */
-			if (alpm_list_find_str(newdeps, k->data)) {
-				continue;
-			}
+	for (k = deps; k; k = k->next) {
+		pkgpair.pkgname = k->data;
 
-			/* Check against localdb */
-			if (hash_search(hashdb->local, &pkgpair)) {
-				if (config->verbose) {
-					printf("%s%s - Already installed\n", TAB, k->data);
-				}
+		/* Check against newdeps */
+		if (alpm_list_find_str(newdeps, k->data)) {
+			continue;
+		}
 
-				continue;
+		/* Check against localdb */
+		if (hash_search(hashdb->local, &pkgpair)) {
+			if (config->verbose) {
+				printf("%s%s - Already installed\n", TAB, k->data);
 			}
 
-			/* Check against sync dbs */
-			pkgpair_ptr = hash_search(hashdb->sync, &pkgpair);
-			if (pkgpair_ptr) {
-				if (config->verbose) {
-					printf("%s%s can be found in %s repo\n", TAB, k->data,
-						   alpm_db_get_name(alpm_pkg_get_db(pkgpair_ptr->pkg)));
-				}
+			continue;
+		}
 
-				continue;
+		/* Check against sync dbs */
+		pkgpair_ptr = hash_search(hashdb->sync, &pkgpair);
+		if (pkgpair_ptr) {
+			if (config->verbose) {
+				printf("%s%s can be found in %s repo\n", TAB, k->data,
+					   alpm_db_get_name(pkgpair_ptr->db));
 			}
 
-			/* Check against provides */
-			pkgpair_ptr = hashbst_tree_search(hashdb->local_provides, k->data,
-											  hashdb->local, provides_search);
-			if (pkgpair_ptr) {
-				if (config->verbose) {
-					printf("%s%s is provided by %s\n", TAB, k->data, pkgpair_ptr->pkgname);
-				}
-				continue;
-			}
+			continue;
+		}
 
-			pkgpair_ptr = hashbst_tree_search(hashdb->sync_provides, k->data,
-											  hashdb->sync, provides_search);
-			if (pkgpair_ptr) {
-				if (config->verbose) {
-					printf("%s%s is provided by %s\n", TAB, k->data, pkgpair_ptr->pkgname);
-				}
-				continue;
+		/* Check against provides */
+		pkgpair_ptr = csrmap_find(hashdb->local_provides, k->data,
+								  hashdb->local, provides_search);
+		if (pkgpair_ptr) {
+			if (config->verbose) {
+				printf("%s%s is provided by %s\n", TAB, k->data, pkgpair_ptr->pkgname);
 			}
+			continue;
+		}
 
-			/* Check the directory for pkg/PKGBUILD */
-			snprintf(pkgbuild, PATH_MAX, "%s/PKGBUILD", k->data);
-			if (!stat(pkgbuild, &st)) {
-				if (config->verbose) {
-					printf("%s%s has been downloaded\n", TAB, k->data);
-				}
-
-				continue;
+		pkgpair_ptr = csrmap_find(hashdb->sync_provides, k->data,
+								  hashdb->sync, provides_search);
+		if (pkgpair_ptr) {
+			if (config->verbose) {
+				printf("%s%s is provided by %s\n", TAB, k->data, pkgpair_ptr->pkgname);
 			}
+			continue;
+		}
 
-			/* Add to newdeps */
-			newdeps = alpm_list_add(newdeps, strdup(k->data));
+		/* Check the directory for pkg/PKGBUILD */
+		snprintf(pkgbuild, PATH_MAX, "%s/PKGBUILD", k->data);
+		if (!stat(pkgbuild, &st)) {
 			if (config->verbose) {
-				printf("%s%s will be downloaded from the AUR\n", TAB, k->data);
+				printf("%s%s has been downloaded\n", TAB, k->data);
 			}
+
+			continue;
 		}
 
-		/* Free deps */
-		FREELIST(deps);
+		/* Add to newdeps */
+		newdeps = alpm_list_add(newdeps, strdup(k->data));
+		if (config->verbose) {
+			printf("%s%s will be downloaded from the AUR\n", TAB, k->data);
+		}
 	}
 
+	/* Free deps */
+	FREELIST(deps);
 	return newdeps;
 }
 
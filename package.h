@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <alpm.h>
 
+#include "arena.h"
 #include "hashdb.h"
 #include "powaur.h"
 
@@ -28,11 +29,41 @@ struct aurpkg_t {
 	alpm_list_t *replaces;
 };
 
-struct aurpkg_t *aurpkg_new(void);
-void aurpkg_free(struct aurpkg_t *pkg);
+/* Frees the lists of pkg, as filled in by parse_pkgbuild */
+void aurpkg_free_lists(struct aurpkg_t *pkg);
 int aurpkg_name_cmp(const void *a, const void *b);
+/* Most votes first, ties are broken by name */
 int aurpkg_vote_cmp(const void *a, const void *b);
 
+/* A set of AUR packages, eg. the results of a query.
+ * Packages are packed into one array and their strings live in pool, so
+ * freeing a set does not depend on its size. Lists are not covered by
+ * this, callers filling them in free them with aurpkg_free_lists.
+ */
+struct aurpkg_set {
+	struct aurpkg_t *pkgs;
+	unsigned int nr;
+	unsigned int sz;
+	struct arena *pool;
+};
+
+struct aurpkg_set *aurpkg_set_new(void);
+void aurpkg_set_free(struct aurpkg_set *set);
+
+/* Returns a new zeroed package at the end of set.
+ * Invalidates pointers to the packages already in set.
+ */
+struct aurpkg_t *aurpkg_set_add(struct aurpkg_set *set);
+
+/* Removes the last package of set */
+void aurpkg_set_pop(struct aurpkg_set *set);
+
+/* Moves the packages of src to the end of dst and frees src */
+void aurpkg_set_merge(struct aurpkg_set *dst, struct aurpkg_set *src);
+
+/* Sorts the packages with aurpkg_name_cmp or aurpkg_vote_cmp */
+void aurpkg_set_sort(struct aurpkg_set *set, int (*cmp) (const void *, const void *));
+
 void parse_pkgbuild(struct aurpkg_t *pkg, FILE *fp);
 
 /* Returns the list of char * of dependencies specified in pkgbuild
@@ -40,11 +71,13 @@ void parse_pkgbuild(struct aurpkg_t *pkg, FILE *fp);
  */
 alpm_list_t *grab_dependencies(const char *pkgbuild);
 
-/* Resolve dependencies for powaur_get
- * returns the list of strings of unresolved packages. The list and strings
- * are to be freed by the caller.
+/* Resolve dependencies of a single extracted package for powaur_get.
+ * Only reads hashdb, so it is safe to call from several threads at once.
+ *
+ * returns the list of strings of dependencies which have to come from the
+ * AUR. The list and strings are to be freed by the caller.
  */
-alpm_list_t *resolve_dependencies(struct pw_hashdb *hashdb, alpm_list_t *packages);
+alpm_list_t *resolve_pkg_dependencies(struct pw_hashdb *hashdb, const char *pkgname);
 
 /* Returns a statically allocated string indicating wich db the pkg came from */
 const char *which_db(alpm_list_t *sdbs, const char *pkgname, alpm_list_t **grp);
@@ -9,10 +9,11 @@
 #include <curl/curl.h>
 #include <yajl/yajl_parse.h>
 
+#include "cache.h"
 #include "curl.h"
 #include "download.h"
 #include "environment.h"
-#include "handle.h"
+#include "intern.h"
 #include "json.h"
 #include "package.h"
 #include "powaur.h"
@@ -24,8 +25,9 @@ static alpm_list_t *powaur_targets = NULL;
 static int powaur_cleanup(int ret)
 {
 	FREELIST(powaur_targets);
+	cache_cleanup();
+	intern_cleanup();
 	curl_cleanup();
-	_pwhandle_free(pwhandle);
 	cleanup_environment();
 	alpm_release(config->handle);
 
@@ -42,11 +44,6 @@ static int powaur_init(void)
 		return error(PW_ERR_INIT_ENV);
 	}
 
-	pwhandle = _pwhandle_init();
-	if (!pwhandle) {
-		return error(PW_ERR_INIT_HANDLE);
-	}
-
 	if (stat(powaur_dir, &st) != 0) {
 		if (mkdir(powaur_dir, 0755)) {
 			return error(PW_ERR_INIT_DIR);
@@ -83,6 +80,7 @@ static void usage(unsigned short op)
 		printf("%s%s {-V --version}\n", TAB, MYNAME);
 		printf("%s%s --crawl <%s>\n", TAB, MYNAME, PKG);
 		printf("%s%s --list-aur\n", TAB, MYNAME);
+		printf("%s%s --cache [--clean]\n", TAB, MYNAME);
 	} else {
 		if (op == PW_OP_SYNC) {
 			printf("%s %s {-S --sync} [%s] [%s]\n", USAGE, MYNAME, OPT, PKG);
@@ -96,6 +94,8 @@ static void usage(unsigned short op)
 			printf("%s %s {-B --backup} [dir]\n", USAGE, MYNAME);
 		} else if (op == PW_OP_LISTAUR) {
 			printf("%s %s --list-aur\n", USAGE, MYNAME);
+		} else if (op == PW_OP_CACHE) {
+			printf("%s %s --cache [--clean]\n", USAGE, MYNAME);
 		}
 
 		printf("%s:\n", OPT);
@@ -118,6 +118,9 @@ static void usage(unsigned short op)
 		case PW_OP_CRAWL:
 			printf("      --crawl <%s>    outputs dependency graph for %s\n", PKG, PKG);
 			break;
+		case PW_OP_CACHE:
+			printf("      --clean                removes cached snapshots, expired RPC responses and shared sources\n");
+			break;
 		default:
 			break;
 		}
@@ -125,6 +128,7 @@ static void usage(unsigned short op)
 		if (op == PW_OP_SYNC) {
 			printf("      --check                Works with -u, checks for outdated packages without upgrading\n");
 			printf("  -u, --upgrade              Updates outdated AUR packages\n");
+			printf("      --jobs <N>             build up to N independent packages at once\n");
 			printf("      --vote                 order search results by votes\n");
 		}
 
@@ -185,6 +189,10 @@ static int parsearg_op(int option, int dry_run)
 		if (dry_run) break;
 		config->op = (config->op == PW_OP_MAIN ? PW_OP_LISTAUR : PW_OP_INVAL);
 		break;
+	case PW_OP_CACHE:
+		if (dry_run) break;
+		config->op = (config->op == PW_OP_MAIN ? PW_OP_CACHE : PW_OP_INVAL);
+		break;
 	default:
 		return -1;
 	}
@@ -246,6 +254,20 @@ static int parsearg_get(int option)
 	return 0;
 }
 
+/* Parse options for --cache */
+static int parsearg_cache(int option)
+{
+	switch (option) {
+	case OPT_CACHE_CLEAN:
+		config->op_c_clean = 1;
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
 /* Parse global arguments */
 static int parsearg_global(int option)
 {
@@ -267,6 +289,13 @@ static int parsearg_global(int option)
 		config->opt_maxthreads = 1;
 		powaur_maxthreads = atoi(optarg);
 		break;
+	case OPT_BUILDJOBS:
+		config->opt_buildjobs = 1;
+		config->buildjobs = atoi(optarg);
+		if (config->buildjobs < 1 || config->buildjobs > PW_MAX_BUILDJOBS) {
+			config->buildjobs = PW_DEF_BUILDJOBS;
+		}
+		break;
 	case OPT_COLOR:
 		if (!config->color_set) {
 			++config->color;
@@ -310,6 +339,8 @@ static int parseargs(int argc, char *argv[])
 		{"search", no_argument, NULL, 's'},
 		{"upgrade", no_argument, NULL, 'u'},
 		{"list-aur", no_argument, NULL, PW_OP_LISTAUR},
+		{"cache", no_argument, NULL, PW_OP_CACHE},
+		{"clean", no_argument, NULL, OPT_CACHE_CLEAN},
 		{"check", no_argument, NULL, OPT_CHECK_ONLY},
 		{"color", no_argument, NULL, OPT_COLOR},
 		{"crawl", no_argument, NULL, PW_OP_CRAWL},
@@ -321,6 +352,7 @@ static int parseargs(int argc, char *argv[])
 		{"target", required_argument, NULL, OPT_TARGET_DIR},
 		{"deps", no_argument, NULL, OPT_RESOLVE_DEPS},
 		{"threads", required_argument, NULL, OPT_MAXTHREADS},
+		{"jobs", required_argument, NULL, OPT_BUILDJOBS},
 		{0, 0, 0, 0}
 	};
 
@@ -372,6 +404,9 @@ static int parseargs(int argc, char *argv[])
 		case PW_OP_GET:
 			res = parsearg_get(opt);
 			break;
+		case PW_OP_CACHE:
+			res = parsearg_cache(opt);
+			break;
 		case PW_OP_MAINTAINER:
 		case PW_OP_BACKUP:
 		default:
@@ -420,6 +455,7 @@ int main(int argc, char *argv[])
 {
 	int ret;
 
+	pw_hash_init();
 	if (setup_config()) {
 		goto cleanup;
 	}
@@ -457,6 +493,9 @@ int main(int argc, char *argv[])
 	case PW_OP_LISTAUR:
 		ret = powaur_list_aur();
 		break;
+	case PW_OP_CACHE:
+		ret = powaur_cache();
+		break;
 	default:
 		break;
 	}
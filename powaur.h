@@ -10,7 +10,8 @@ enum {
 	PW_OP_MAINTAINER,
 	PW_OP_BACKUP,
 	PW_OP_CRAWL,
-	PW_OP_LISTAUR
+	PW_OP_LISTAUR,
+	PW_OP_CACHE
 };
 
 enum {
@@ -23,7 +24,9 @@ enum {
 	OPT_COLOR,
 	OPT_NOCOLOR,
 	OPT_CHECK_ONLY,
-	OPT_NOCONFIRM
+	OPT_NOCONFIRM,
+	OPT_CACHE_CLEAN,
+	OPT_BUILDJOBS
 };
 
 enum pwloglevel_t {
@@ -50,7 +53,6 @@ enum _pw_errno_t {
 	PW_ERR_INIT_ALPM_HANDLE,
 	PW_ERR_INIT_ALPM_REGISTER_SYNC,
 	PW_ERR_INIT_ENV,
-	PW_ERR_INIT_HANDLE,
 	PW_ERR_INIT_DIR,
 	PW_ERR_INIT_LOCALDB,
 
@@ -6,6 +6,7 @@
 #include "environment.h"
 #include "graph.h"
 #include "hashdb.h"
+#include "intern.h"
 #include "package.h"
 #include "powaur.h"
 #include "query.h"
@@ -192,6 +193,9 @@ static const char *normalize_package(CURL *curl, struct pw_hashdb *hashdb,
 	struct pkgpair *pkgptr;
 	enum pkgfrom_t *pkgfrom;
 
+	/* Everything cached below keys on the interned name, which outlives
+	 * the caller's buffer */
+	pkgname = intern(pkgname);
 	pkgpair.pkgname = pkgname;
 	pkgpair.pkg = NULL;
 
@@ -223,8 +227,8 @@ static const char *normalize_package(CURL *curl, struct pw_hashdb *hashdb,
 	}
 
 	/* Search local provides */
-	pkgptr = hashbst_tree_search(hashdb->local_provides, (void *) pkgname,
-								 hashdb->local, provides_search);
+	pkgptr = csrmap_find(hashdb->local_provides, (void *) pkgname,
+						 hashdb->local, provides_search);
 	if (pkgptr) {
 		/* Cache in provides and pkg_from */
 		hashmap_insert(hashdb->provides_cache, (void *) pkgname,
@@ -233,14 +237,14 @@ static const char *normalize_package(CURL *curl, struct pw_hashdb *hashdb,
 		return pkgptr->pkgname;
 	}
 
-	/* Search sync provides tree in local db
+	/* Search sync provides in local db
 	 * TODO: Is there a meaning to this?
 	 * local provides are obtained from local packages.
 	 * sync provides are obtained from sync packages.
 	 * So searching for sync provides in local database is kind of...
 	 */
-	pkgptr = hashbst_tree_search(hashdb->sync_provides, (void *) pkgname,
-								 hashdb->local, provides_search);
+	pkgptr = csrmap_find(hashdb->sync_provides, (void *) pkgname,
+						 hashdb->local, provides_search);
 
 	if (pkgptr) {
 		/* Cache in pkg_from */
@@ -255,8 +259,8 @@ static const char *normalize_package(CURL *curl, struct pw_hashdb *hashdb,
 	}
 
 	/* Sync provides */
-	pkgptr = hashbst_tree_search(hashdb->sync_provides, (void *) pkgname,
-								 hashdb->sync, provides_search);
+	pkgptr = csrmap_find(hashdb->sync_provides, (void *) pkgname,
+						 hashdb->sync, provides_search);
 	if (pkgptr) {
 		hashmap_insert(hashdb->pkg_from, (void *) pkgptr->pkgname,
 					   &hashdb->pkg_from_sync);
@@ -307,7 +311,6 @@ static int crawl_resolve(CURL *curl, struct pw_hashdb *hashdb, struct pkgpair *c
 	struct pkgpair *pkgpair;
 	struct pkgpair tmppkg;
 	void *pkg_provides;
-	void *memlist_ptr;
 	const char *cache_result;
 	const char *depname, *final_pkgname;
 	char cwd[PATH_MAX];
@@ -348,7 +351,7 @@ get_deps:
 		die("Unable to find package \"%s\" in local/sync db!", final_pkgname);
 	}
 
-	depmod_list = alpm_pkg_get_depends(pkgpair->pkg);
+	depmod_list = alpm_pkg_get_depends(pkgpair_get_pkg(pkgpair));
 	for (i = depmod_list; i; i = i->next) {
 		char *s = alpm_dep_compute_string(i->data);
 		strncpy(buf, s, sizeof(buf));
@@ -404,17 +407,16 @@ aur_deps:
 		const char *normdep;
 		alpm_list_t *new_deps = NULL;
 
-		/* Transfer control to memlist and normalize packages */
+		/* normalize_package interns the names */
 		for (i = deps; i; i = i->next) {
-			memlist_ptr = memlist_add(hashdb->strpool, &i->data);
-			normdep = normalize_package(curl, hashdb, memlist_ptr, resolve_lvl);
+			normdep = normalize_package(curl, hashdb, i->data, resolve_lvl);
 			new_deps = alpm_list_add(new_deps, (void *) normdep);
 		}
 
 		*dep_list = new_deps;
 	}
 
-	alpm_list_free(deps);
+	FREELIST(deps);
 	return 0;
 }
 
@@ -475,37 +477,27 @@ static void add_immediate_deps(struct pw_hashdb *hashdb, const char *pkgname,
 	}
 }
 
-void build_dep_graph(struct graph **graph, struct pw_hashdb *hashdb,
-					 alpm_list_t *targets, int resolve_lvl)
+/* Resolves the dependencies of targets into graph.
+ * Packages in resolved are skipped and packages resolved here are added to
+ * it, so a graph can be grown over several calls without resolving the
+ * packages they share twice.
+ *
+ * returns 0 on success, -1 on error
+ */
+static int dep_graph_extend(CURL *curl, struct graph *graph,
+							struct pw_hashdb *hashdb, alpm_list_t *targets,
+							int resolve_lvl, struct hash_table *resolved,
+							struct hash_table *immediate)
 {
-	if (!graph) {
-		return;
-	}
-
-	if (!*graph) {
-		*graph = graph_new((pw_hash_fn) sdbm, (pw_hashcmp_fn) strcmp);
-	}
-
 	struct stack *st = stack_new(sizeof(struct pkgpair));
-	struct hash_table *resolved = hash_new(HASH_TABLE, (pw_hash_fn) sdbm,
-										   (pw_hashcmp_fn) strcmp);
-	struct hash_table *immediate = hash_new(HASH_TABLE, (pw_hash_fn) sdbm,
-											(pw_hashcmp_fn) strcmp);
-	int ret;
+	int ret = 0;
 	struct pkgpair pkgpair, deppkg;
 	alpm_list_t *i;
 	alpm_list_t *deps;
 
-	CURL *curl;
-	curl = curl_easy_new();
-	if (!curl) {
-		error(PW_ERR_CURL_INIT);
-		return;
-	}
-
 	/* Push all packages down stack */
 	for (i = targets; i; i = i->next) {
-		pkgpair.pkgname = i->data;
+		pkgpair.pkgname = intern(i->data);
 		pkgpair.pkg = NULL;
 		stack_push(st, &pkgpair);
 	}
@@ -521,7 +513,8 @@ void build_dep_graph(struct graph **graph, struct pw_hashdb *hashdb,
 		ret = crawl_resolve(curl, hashdb, &pkgpair, &deps, resolve_lvl);
 		if (ret) {
 			pw_fprintf(PW_LOG_ERROR, stderr, "Error in resolving packages.\n");
-			goto cleanup;
+			ret = -1;
+			break;
 		}
 
 		for (i = deps; i; i = i->next) {
@@ -532,7 +525,7 @@ void build_dep_graph(struct graph **graph, struct pw_hashdb *hashdb,
 			should_we_continue_resolving(curl, hashdb, st, &deppkg, resolve_lvl);
 
 			/* dep --> current */
-			graph_add_edge(*graph, i->data, (void *) pkgpair.pkgname);
+			graph_add_edge(graph, i->data, (void *) pkgpair.pkgname);
 		}
 
 		hash_insert(resolved, (void *) pkgpair.pkgname);
@@ -543,11 +536,40 @@ cleanup_deps:
 		alpm_list_free(deps);
 	}
 
+	stack_free(st);
+	return ret;
+}
+
+void build_dep_graph(struct graph **graph, struct pw_hashdb *hashdb,
+					 alpm_list_t *targets, int resolve_lvl)
+{
+	if (!graph) {
+		return;
+	}
+
+	if (!*graph) {
+		*graph = graph_new((pw_hash_fn) pw_strhash, intern_cmp);
+	}
+
+	struct hash_table *resolved = hash_new(HASH_TABLE, (pw_hash_fn) pw_strhash,
+										   intern_cmp);
+	struct hash_table *immediate = hash_new(HASH_TABLE, (pw_hash_fn) pw_strhash,
+											intern_cmp);
+
+	CURL *curl;
+	curl = curl_easy_new();
+	if (!curl) {
+		error(PW_ERR_CURL_INIT);
+		goto cleanup;
+	}
+
+	dep_graph_extend(curl, *graph, hashdb, targets, resolve_lvl, resolved,
+					 immediate);
+	curl_easy_cleanup(curl);
+
 cleanup:
 	hash_free(resolved);
 	hash_free(immediate);
-	stack_free(st);
-	curl_easy_cleanup(curl);
 }
 
 void print_topo_order(struct graph *graph, struct stack *topost)
@@ -589,37 +611,107 @@ int powaur_crawl(alpm_list_t *targets)
 	if (!hashdb) {
 		pw_fprintf(PW_LOG_ERROR, stderr, "Unable to build hash database!\n");
 		ret = -1;
+		goto restore_cwd;
 	}
 
-	alpm_list_t *i, *target_pkgs;
-	struct graph *graph;
-	struct stack *topost = stack_new(sizeof(int));
-	int have_cycles;
+	CURL *curl = curl_easy_new();
+	if (!curl) {
+		error(PW_ERR_CURL_INIT);
+		hashdb_free(hashdb);
+		ret = -1;
+		goto restore_cwd;
+	}
+
+	/* All targets share one graph, so that the packages they have in
+	 * common are only resolved once.
+	 */
+	alpm_list_t *i, *target_pkgs, *failed = NULL;
+	struct graph *graph = graph_new((pw_hash_fn) pw_strhash, intern_cmp);
+	struct hash_table *resolved = hash_new(HASH_TABLE, (pw_hash_fn) pw_strhash,
+										   intern_cmp);
+	struct hash_table *immediate = hash_new(HASH_TABLE, (pw_hash_fn) pw_strhash,
+											intern_cmp);
 	for (i = targets; i; i = i->next) {
-		stack_reset(topost);
-		graph = NULL;
+		graph_add_vertex(graph, (void *) intern(i->data));
 		target_pkgs = alpm_list_add(NULL, i->data);
-		build_dep_graph(&graph, hashdb, target_pkgs, RESOLVE_THOROUGH);
+		if (dep_graph_extend(curl, graph, hashdb, target_pkgs, RESOLVE_THOROUGH,
+							 resolved, immediate)) {
+			failed = alpm_list_add(failed, i->data);
+		}
+
+		alpm_list_free(target_pkgs);
+	}
+
+	curl_easy_cleanup(curl);
+	hash_free(resolved);
+	hash_free(immediate);
+
+	/* Show the members of every cycle, once */
+	struct stack *topost = stack_new(sizeof(int));
+	graph_enable_debug_resolve();
+	graph_toposort(graph, topost);
+	graph_disable_debug_resolve();
+
+	/* Every target's order is the shared order restricted to its deps */
+	int *order = xmalloc((graph->nr + 1) * sizeof(int));
+	int nr = 0, idx, cnt, have_cycles;
+	while (!stack_empty(topost)) {
+		stack_pop(topost, &order[nr++]);
+	}
+
+	int *comp;
+	unsigned char *cyclic;
+	unsigned char *mark = xmalloc(graph->nr + 1);
+	graph_scc(graph, &comp, &cyclic);
+
+	for (i = targets; i; i = i->next) {
+		if (alpm_list_find_str(failed, i->data)) {
+			continue;
+		}
+
+		memset(mark, 0, graph->nr + 1);
+		cnt = graph_ancestors(graph, graph_vertex_id(graph, (void *) intern(i->data)),
+							  mark);
+
+		have_cycles = 0;
+		for (idx = 0; idx < nr; ++idx) {
+			if (mark[order[idx]] && cyclic[comp[order[idx]]]) {
+				have_cycles = 1;
+				break;
+			}
+		}
+
 		if (have_cycles) {
 			printf("Cyclic dependencies for package \"%s\"\n", i->data);
 		}
 
-		graph_toposort(graph, topost);
-		if (stack_empty(topost)) {
+		if (cnt <= 1) {
 			printf("Package \"%s\" has no dependencies.\n", i->data);
-		} else {
-			printf("\n");
-			pw_printf(PW_LOG_INFO, "\"%s\" topological order: ", i->data);
-			print_topo_order(graph, topost);
+			continue;
 		}
 
-		graph_free(graph);
-		alpm_list_free(target_pkgs);
+		printf("\n");
+		pw_printf(PW_LOG_INFO, "\"%s\" topological order: ", i->data);
+		stack_reset(topost);
+		for (idx = nr - 1; idx >= 0; --idx) {
+			if (mark[order[idx]]) {
+				stack_push(topost, &order[idx]);
+			}
+		}
+
+		print_topo_order(graph, topost);
 	}
 
+	free(order);
+	free(comp);
+	free(cyclic);
+	free(mark);
+	alpm_list_free(failed);
 	stack_free(topost);
+	graph_free(graph);
 	hashdb_free(hashdb);
 
+restore_cwd:
 	if (chdir(cwd)) {
 		return error(PW_ERR_RESTORECWD);
 	}
@@ -630,7 +722,8 @@ void pkgpair_print_color(void *p)
 {
 	struct pkgpair *pkgpair_ptr = p;
 	printf("%s%s%s %s%s%s\n", color.bold, pkgpair_ptr->pkgname, color.nocolor,
-		   color.bgreen, alpm_pkg_get_version(pkgpair_ptr->pkg), color.nocolor);
+		   color.bgreen, alpm_pkg_get_version(pkgpair_get_pkg(pkgpair_ptr)),
+		   color.nocolor);
 }
 
 int powaur_list_aur(void)
@@ -9,7 +9,8 @@
 enum aurquery_t {
 	AUR_QUERY_SEARCH,
 	AUR_QUERY_INFO,
-	AUR_QUERY_MSEARCH
+	AUR_QUERY_MSEARCH,
+	AUR_QUERY_MULTIINFO
 };
 
 enum {
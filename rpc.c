@@ -0,0 +1,229 @@
+#include <limits.h>
+#include <string.h>
+
+#include <curl/curl.h>
+#include <yajl/yajl_parse.h>
+
+#include "cache.h"
+#include "curl.h"
+#include "environment.h"
+#include "error.h"
+#include "json.h"
+#include "package.h"
+#include "powaur.h"
+#include "rpc.h"
+#include "util.h"
+#include "wrapper.h"
+
+struct aur_rpc_req {
+	enum aurquery_t type;
+	char *arg;
+	aur_rpc_cb cb;
+	void *userdata;
+
+	/* Each request has its own parser */
+	struct json_ctx_t json_ctx;
+	struct json_resp resp;
+	CURL *curl;
+};
+
+struct aur_rpc {
+	CURLM *multi;
+
+	/* Requests in order of addition, next points to the first not started */
+	alpm_list_t *reqs;
+	alpm_list_t *next;
+
+	/* Easy handles available for reuse */
+	alpm_list_t *idle;
+
+	int max_inflight;
+	int inflight;
+	int failed;
+};
+
+struct aur_rpc *aur_rpc_new(int max_inflight)
+{
+	struct aur_rpc *rpc = xcalloc(1, sizeof(struct aur_rpc));
+	rpc->multi = curl_multi_init();
+	if (!rpc->multi) {
+		die_errno(PW_ERR_CURL_INIT);
+	}
+
+	rpc->max_inflight = max_inflight > 0 ? max_inflight : 1;
+	return rpc;
+}
+
+static void aur_rpc_req_free(struct aur_rpc_req *req)
+{
+	if (!req) {
+		return;
+	}
+
+	free(req->resp.raw);
+	free(req->arg);
+	free(req);
+}
+
+void aur_rpc_free(struct aur_rpc *rpc)
+{
+	alpm_list_t *i;
+	if (!rpc) {
+		return;
+	}
+
+	for (i = rpc->idle; i; i = i->next) {
+		curl_easy_cleanup(i->data);
+	}
+
+	alpm_list_free(rpc->idle);
+	alpm_list_free_inner(rpc->reqs, (alpm_list_fn_free) aur_rpc_req_free);
+	alpm_list_free(rpc->reqs);
+	curl_multi_cleanup(rpc->multi);
+	free(rpc);
+}
+
+void aur_rpc_add(struct aur_rpc *rpc, enum aurquery_t type, const char *arg,
+				 aur_rpc_cb cb, void *userdata)
+{
+	struct aur_rpc_req *req = xcalloc(1, sizeof(struct aur_rpc_req));
+	req->type = type;
+	req->arg = xstrdup(arg);
+	req->cb = cb;
+	req->userdata = userdata;
+
+	rpc->reqs = alpm_list_add(rpc->reqs, req);
+	if (!rpc->next) {
+		rpc->next = alpm_list_last(rpc->reqs);
+	}
+}
+
+/* Puts a request on the wire.
+ * returns 0 on success, -1 on failure.
+ */
+static int aur_rpc_start(struct aur_rpc *rpc, struct aur_rpc_req *req)
+{
+	char url[PATH_MAX];
+
+	if (rpc->idle) {
+		req->curl = rpc->idle->data;
+		rpc->idle = alpm_list_remove_item(rpc->idle, rpc->idle);
+	} else {
+		req->curl = curl_easy_new();
+		if (!req->curl) {
+			return error(PW_ERR_CURL_INIT);
+		}
+	}
+
+	req->resp.hand = yajl_init(&req->json_ctx);
+
+	aur_rpc_url(url, PATH_MAX, req->type, req->arg);
+	pw_printf(PW_LOG_DEBUG, "rpc: %s\n", url);
+
+	curl_reset(req->curl);
+	curl_easy_setopt(req->curl, CURLOPT_WRITEFUNCTION, parse_json_resp);
+	curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, &req->resp);
+	curl_easy_setopt(req->curl, CURLOPT_URL, url);
+	curl_easy_setopt(req->curl, CURLOPT_PRIVATE, req);
+
+	curl_multi_add_handle(rpc->multi, req->curl);
+	rpc->inflight++;
+	return 0;
+}
+
+/* Starts queued requests until we hit max_inflight */
+static void aur_rpc_fill(struct aur_rpc *rpc)
+{
+	struct aur_rpc_req *req;
+	char *data;
+	size_t len;
+
+	while (rpc->next && rpc->inflight < rpc->max_inflight) {
+		req = rpc->next->data;
+		rpc->next = rpc->next->next;
+
+		/* Fresh responses from the RPC cache need no request at all */
+		data = rpc_cache_get(req->type, req->arg, &len);
+		if (data) {
+			req->cb(req->arg, parse_json_buf(data, len), req->userdata);
+			free(data);
+			continue;
+		}
+
+		if (aur_rpc_start(rpc, req)) {
+			rpc->failed++;
+			req->cb(req->arg, NULL, req->userdata);
+		}
+	}
+}
+
+/* Finishes parsing a completed request and hands the results over */
+static void aur_rpc_finish(struct aur_rpc *rpc, struct aur_rpc_req *req,
+						   CURLcode result)
+{
+	struct aurpkg_set *results = NULL;
+	long httpresp = 0;
+
+	yajl_complete_parse(req->resp.hand);
+	yajl_free(req->resp.hand);
+	req->resp.hand = NULL;
+
+	curl_stats_update(req->curl);
+	curl_easy_getinfo(req->curl, CURLINFO_RESPONSE_CODE, &httpresp);
+
+	if (result != CURLE_OK || httpresp != 200) {
+		if (result != CURLE_OK) {
+			pw_fprintf(PW_LOG_ERROR, stderr, "curl: %s\n", curl_easy_strerror(result));
+		} else {
+			pw_fprintf(PW_LOG_ERROR, stderr, "curl responded with http code %ld\n",
+					   httpresp);
+		}
+
+		json_ctx_cleanup(&req->json_ctx);
+		rpc->failed++;
+	} else {
+		results = json_ctx_results(&req->json_ctx);
+		rpc_cache_put(req->type, req->arg, req->resp.raw, req->resp.len);
+	}
+
+	free(req->resp.raw);
+	memset(&req->resp, 0, sizeof(struct json_resp));
+
+	curl_multi_remove_handle(rpc->multi, req->curl);
+	rpc->idle = alpm_list_add(rpc->idle, req->curl);
+	req->curl = NULL;
+	rpc->inflight--;
+
+	req->cb(req->arg, results, req->userdata);
+}
+
+int aur_rpc_run(struct aur_rpc *rpc)
+{
+	struct aur_rpc_req *req;
+	CURLMsg *msg;
+	int running, msgs;
+
+	aur_rpc_fill(rpc);
+
+	while (rpc->inflight > 0) {
+		curl_multi_perform(rpc->multi, &running);
+
+		while ((msg = curl_multi_info_read(rpc->multi, &msgs))) {
+			if (msg->msg != CURLMSG_DONE) {
+				continue;
+			}
+
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &req);
+			aur_rpc_finish(rpc, req, msg->data.result);
+		}
+
+		/* Keep the pipe full */
+		aur_rpc_fill(rpc);
+
+		if (running) {
+			curl_multi_wait(rpc->multi, NULL, 0, 1000, NULL);
+		}
+	}
+
+	return rpc->failed;
+}
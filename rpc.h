@@ -0,0 +1,42 @@
+#ifndef POWAUR_RPC_H
+#define POWAUR_RPC_H
+
+#include <alpm_list.h>
+
+#include "query.h"
+
+/* Asynchronous AUR RPC engine.
+ * Requests are queued with aur_rpc_add and run concurrently over the curl
+ * multi interface by aur_rpc_run, with at most max_inflight requests on the
+ * wire at any one time.
+ */
+
+/* Opaque */
+struct aur_rpc;
+
+/* Forward declaration */
+struct aurpkg_set;
+
+/* Called as soon as a request completes.
+ *
+ * @param arg argument the request was queued with
+ * @param results set of packages, NULL on failure / no results.
+ *        The set belongs to the callback.
+ * @param userdata data passed to aur_rpc_add
+ */
+typedef void (*aur_rpc_cb) (const char *arg, struct aurpkg_set *results,
+							void *userdata);
+
+struct aur_rpc *aur_rpc_new(int max_inflight);
+void aur_rpc_free(struct aur_rpc *rpc);
+
+/* Queues a request. arg is copied. */
+void aur_rpc_add(struct aur_rpc *rpc, enum aurquery_t type, const char *arg,
+				 aur_rpc_cb cb, void *userdata);
+
+/* Runs all queued requests to completion.
+ * returns the number of failed requests.
+ */
+int aur_rpc_run(struct aur_rpc *rpc);
+
+#endif
@@ -7,6 +7,7 @@
 #include <alpm.h>
 #include <curl/curl.h>
 
+#include "build.h"
 #include "curl.h"
 #include "download.h"
 #include "environment.h"
@@ -14,176 +15,22 @@
 #include "graph.h"
 #include "hash.h"
 #include "hashdb.h"
+#include "intern.h"
 #include "json.h"
 #include "package.h"
 #include "powaur.h"
 #include "sync.h"
 #include "util.h"
 
-/* Converts a list of strings into an array of char * terminated by NULL.
- * The returned pointer is to be freed by the caller.
-
- * @param list list of char *
- */
-char **list_to_argv(alpm_list_t *args)
-{
-	alpm_list_t *i;
-	int cnt, total;
-
-	total = alpm_list_count(args);
-	if (!total) {
-		return NULL;
-	}
-
-	total++;
-	char **argv = xcalloc(total, sizeof(char *));
-	for (cnt = 0, i = args; i; i = i->next) {
-		argv[cnt++] = i->data;
-	}
-
-	argv[cnt] = NULL;
-	return argv;
-}
-
-/* Installs a single succesfully downloaded PKGBUILD using makepkg -si
- * Assumes that the package has been extracted into its own directory
- *
- * returns 0 if installation is successful
- * returns -1 for errors, -2 for fatal errors
- */
-static int install_single_package(char *pkgname)
-{
-	static const char choices[] = {'y', 'n', 'a', 'Y', 'N', 'A'};
-	int ret;
-	char cwd[PATH_MAX];
-	char buf[PATH_MAX];
-	char *dotinstall;
-	pid_t pid;
-
-	if (!getcwd(cwd, PATH_MAX)) {
-		return error(PW_ERR_GETCWD);
-	}
-
-	if (chdir(pkgname)) {
-		return error(PW_ERR_CHDIR, pkgname);
-	}
-
-	if (config->noconfirm) {
-		goto fork_pacman;
-	}
-
-	/* Ask user to edit PKGBUILD */
-	snprintf(buf, PATH_MAX, "Edit PKGBUILD for %s? [Y/n/a]", pkgname);
-	ret = mcq(buf, choices, sizeof(choices) / sizeof(*choices), 0);
-
-	switch (ret) {
-	case 1:
-		goto edit_dotinstall;
-	case 2:
-		/* Abort, propagate upwards */
-		return -2;
-	}
-
-	/* Fork editor */
-	pid = fork();
-	if (pid == (pid_t) -1) {
-		return error(PW_ERR_FORK_FAILED);
-	} else if (pid == 0) {
-		/* Open editor */
-		execlp(powaur_editor, powaur_editor, "PKGBUILD", NULL);
-	} else {
-		ret = wait_or_whine(pid, "vim");
-		if (ret) {
-			return -1;
-		}
-	}
-
-edit_dotinstall:
-	/* First, check if we have .install file */
-	dotinstall = have_dotinstall();
-	if (dotinstall) {
-		snprintf(buf, PATH_MAX, "Edit .install for %s? [Y/n/a]", pkgname);
-		ret = mcq(buf, choices, sizeof(choices) / sizeof(*choices), 0);
-
-		switch (ret) {
-		case 1:
-			goto fork_pacman;
-		case 2:
-			free(dotinstall);
-			return -2;
-		}
-
-		pid = fork();
-		if (pid == (pid_t) - 1) {
-			return error(PW_ERR_FORK_FAILED);
-		} else if (pid == 0) {
-			execlp(powaur_editor, powaur_editor, dotinstall, NULL);
-		} else {
-			ret = wait_or_whine(pid, "vim");
-			if (ret) {
-				free(dotinstall);
-				return -1;
-			}
-		}
-	}
-
-fork_pacman:
-	free(dotinstall);
-
-	if (!config->noconfirm && !yesno("Continue installing %s?", pkgname)) {
-		return -2;
-	}
-
-	alpm_list_t *args = alpm_list_add(NULL, xstrdup("makepkg"));
-	alpm_list_add(args, xstrdup("-si"));
-
-	if (config->noconfirm) {
-		alpm_list_add(args, xstrdup("--noconfirm"));
-	}
-
-	/* Check if we're root. Invoke makepkg with --asroot if so */
-	uid_t myuid = geteuid();
-	if (myuid == 0) {
-		alpm_list_add(args, xstrdup("--asroot"));
-	}
-
-	char **argv = list_to_argv(args);
-	pid = fork();
-	if (pid == (pid_t) -1) {
-		return error(PW_ERR_FORK_FAILED);
-	} else if (pid == 0) {
-		execvp("makepkg", argv);
-	} else {
-		/* Parent process */
-		ret = wait_or_whine(pid, "makepkg");
-		if (ret) {
-			ret = -1;
-			goto cleanup;
-		}
-
-		ret = 0;
-	}
-
-cleanup:
-	free(argv);
-	FREELIST(args);
-
-	/* Change back to old directory */
-	if (chdir(cwd)) {
-		RET_ERR(PW_ERR_RESTORECWD, -2);
-	}
-
-	return ret;
-}
-
 /* Search sync db for packages. Only works for 1 package now. */
 static int sync_search(CURL *curl, alpm_list_t *targets)
 {
-	alpm_list_t *i, *j, *search_results;
+	alpm_list_t *i, *j;
 	alpm_db_t *db;
 	alpm_pkg_t *spkg;
+	struct aurpkg_set *search_results;
 	struct aurpkg_t *pkg;
-	size_t listsz;
+	unsigned int idx;
 
 	search_results = query_aur(curl, targets->data, AUR_QUERY_SEARCH);
 	if (search_results == NULL) {
@@ -191,17 +38,12 @@ static int sync_search(CURL *curl, alpm_list_t *targets)
 		return 0;
 	}
 
-	listsz = alpm_list_count(search_results);
-	/* Sort by alphabetical order first */
-	search_results = alpm_list_msort(search_results, listsz, aurpkg_name_cmp);
+	/* Sort by votes or alphabetical order */
+	aurpkg_set_sort(search_results, config->sort_votes ? aurpkg_vote_cmp :
+					aurpkg_name_cmp);
 
-	/* Sort by votes */
-	if (config->sort_votes) {
-		search_results = alpm_list_msort(search_results, listsz, aurpkg_vote_cmp);
-	}
-
-	for (i = search_results; i; i = i->next) {
-		pkg = (struct aurpkg_t *) i->data;
+	for (idx = 0; idx < search_results->nr; ++idx) {
+		pkg = search_results->pkgs + idx;
 		printf("%saur/%s%s%s %s%s %s(%d)%s\n", color.bmag,
 			   color.nocolor, color.bold, pkg->name,
 			   color.bgreen, pkg->version,
@@ -209,9 +51,7 @@ static int sync_search(CURL *curl, alpm_list_t *targets)
 		printf("    %s\n", pkg->desc);
 	}
 
-	alpm_list_free_inner(search_results, (alpm_list_fn_free) aurpkg_free);
-	alpm_list_free(search_results);
-
+	aurpkg_set_free(search_results);
 	return 0;
 }
 
@@ -240,14 +80,17 @@ static alpm_pkg_t *search_syncdbs(alpm_list_t *dbs, const char *pkgname)
 static int sync_info(CURL *curl, alpm_list_t *targets)
 {
 	int found, ret, pkgcount;
-	alpm_list_t *i, *j, *results;
-	alpm_list_t *free_list = NULL;
+	alpm_list_t *i, *j;
+	alpm_list_t *aur_targets = NULL;
+	struct aurpkg_set *results;
 	alpm_list_t *syncdbs = alpm_option_get_syncdbs(config->handle);
 	alpm_pkg_t *spkg;
+	struct hashmap *sync_table, *aurpkg_table;
 
 	char cwd[PATH_MAX];
 	char filename[PATH_MAX];
 	char url[PATH_MAX];
+	char cachekey[PATH_MAX];
 	FILE *fp = NULL;
 	int fd;
 	struct aurpkg_t *pkg;
@@ -260,10 +103,24 @@ static int sync_info(CURL *curl, alpm_list_t *targets)
 		return error(PW_ERR_CHDIR, powaur_dir);
 	}
 
+	/* Search sync dbs first, everything else is queried from the AUR
+	 * in as few requests as possible.
+	 */
+	sync_table = hashmap_new((pw_hash_fn) pw_strhash, (pw_hashcmp_fn) strcmp);
+	for (i = targets; i; i = i->next) {
+		spkg = search_syncdbs(syncdbs, i->data);
+		if (spkg) {
+			hashmap_insert(sync_table, i->data, spkg);
+		} else {
+			aur_targets = alpm_list_add(aur_targets, i->data);
+		}
+	}
+
+	results = query_aur_multiinfo(curl, aur_targets, &aurpkg_table);
+
 	found = ret = pkgcount = 0;
 	for (i = targets; i; i = i->next, ++pkgcount) {
-		/* Search sync dbs first */
-		spkg = search_syncdbs(syncdbs, i->data);
+		spkg = hashmap_search(sync_table, i->data);
 		if (spkg) {
 			if (found++){
 				printf("\n");
@@ -274,14 +131,14 @@ static int sync_info(CURL *curl, alpm_list_t *targets)
 			continue;
 		}
 
-		results = query_aur(curl, i->data, AUR_QUERY_INFO);
-		if (alpm_list_count(results) != 1) {
+		pkg = hashmap_search(aurpkg_table, i->data);
+		if (!pkg) {
 			if (pkgcount > 0) {
 				printf("\n");
 			}
 
 			pw_printf(PW_LOG_ERROR, "package %s not found\n", i->data);
-			goto garbage_collect;
+			continue;
 		}
 
 		snprintf(filename, PATH_MAX, "%s.PKGBUILDXXXXXX", i->data);
@@ -289,28 +146,27 @@ static int sync_info(CURL *curl, alpm_list_t *targets)
 
 		if (fd < 0) {
 			error(PW_ERR_FOPEN, filename);
-			goto garbage_collect;
+			continue;
 		}
 
 		fp = fdopen(fd, "w+");
 		if (!fp) {
 			printf("NO\n");
 			error(PW_ERR_FOPEN, filename);
-			goto garbage_collect;
+			continue;
 		}
 
-		snprintf(url, PATH_MAX, AUR_PKGBUILD_URL, i->data);
+		snprintf(url, PATH_MAX, AUR_PKGBUILD_URL, powaur_aur_url, i->data);
+		snprintf(cachekey, PATH_MAX, "%s.PKGBUILD", i->data);
 
 		/* Download the PKGBUILD and parse it */
-		ret = download_single_file(curl, url, fp);
+		ret = download_single_file(curl, url, cachekey, fp);
 		if (ret) {
 			goto destroy_remnants;
 		}
 
 		/* Parse PKGBUILD and get detailed info */
 		fseek(fp, 0L, SEEK_SET);
-
-		pkg = results->data;
 		parse_pkgbuild(pkg, fp);
 
 		if (found++) {
@@ -324,7 +180,7 @@ static int sync_info(CURL *curl, alpm_list_t *targets)
 		printf("%s%s %s%s%s\n", color.bold, URL, color.bcyan, pkg->url,
 			   color.nocolor);
 		printf("%s%s%s ", color.bold, A_URL, color.bcyan);
-		printf(AUR_PKG_URL, pkg->id);
+		printf(AUR_PKG_URL, powaur_aur_url, pkg->id);
 		printf("%s\n", color.nocolor);
 
 		printf("%s%s %s%s\n", color.bold, LICENSES, color.nocolor, pkg->license);
@@ -346,23 +202,19 @@ static int sync_info(CURL *curl, alpm_list_t *targets)
 		print_list_prefix(pkg->arch, ARCH);
 
 		printf("%s%s%s %s\n", color.bold, DESC, color.nocolor, pkg->desc);
+		aurpkg_free_lists(pkg);
 
 destroy_remnants:
 		fclose(fp);
 		fp = NULL;
 		unlink(filename);
-
-garbage_collect:
-		free_list = alpm_list_add(free_list, results);
 	}
 
 cleanup:
-	for (i = free_list; i; i = i->next) {
-		alpm_list_free_inner(i->data, (alpm_list_fn_free) aurpkg_free);
-		alpm_list_free(i->data);
-	}
-
-	alpm_list_free(free_list);
+	hashmap_free(sync_table);
+	hashmap_free(aurpkg_table);
+	aurpkg_set_free(results);
+	alpm_list_free(aur_targets);
 
 	if (chdir(cwd)) {
 		return error(PW_ERR_RESTORECWD);
@@ -425,24 +277,71 @@ static void print_immediate_deps(struct pw_hashdb *hashdb)
 /* Installs packages from the AUR
  * Assumes we are already in directory with all the relevant PKGBUILDS dled
  *
+ * Every target is reviewed first, so that sources can be fetched in the
+ * background while earlier targets build. With more than 1 build job,
+ * targets are built level by level, see graph_levels, so that independent
+ * ones build at the same time.
+ *
  * @param hashdb hash database
+ * @param graph dependency graph of the targets
  * @param targets targets to be installed, in topo order
  */
-static int topo_install(struct pw_hashdb *hashdb, alpm_list_t *targets)
+static int topo_install(struct pw_hashdb *hashdb, struct graph *graph,
+						alpm_list_t *targets)
 {
-	alpm_list_t *i;
-	int ret;
+	alpm_list_t *i, *reviewed = NULL;
+	alpm_list_t **levels;
+	int *level;
+	int nlevels, ret;
 
 	pw_printf(PW_LOG_INFO, "Targets (%d):\n", alpm_list_count(targets));
 	print_list_color(targets, color.bmag);
 
 	for (i = targets; i; i = i->next) {
-		ret = install_single_package(i->data);
+		ret = build_review(i->data);
 		if (ret == -2) {
+			alpm_list_free(reviewed);
 			return ret;
+		} else if (!ret) {
+			reviewed = alpm_list_add(reviewed, i->data);
 		}
 	}
-	return 0;
+
+	/* Keep to topo order, as a single level */
+	if (config->buildjobs <= 1 || !reviewed || !reviewed->next) {
+		ret = build_levels(&reviewed, 1, 1);
+		alpm_list_free(reviewed);
+		return ret == -2 ? ret : 0;
+	}
+
+	/* The graph has been toposorted already, so there should be no cycles.
+	 * If there are, the targets can still be built one by one in topo order.
+	 */
+	nlevels = graph_levels(graph, &level);
+	if (nlevels < 0) {
+		pw_fprintf(PW_LOG_WARNING, stderr,
+				   "Cannot build targets in parallel, building them in order\n");
+		ret = build_levels(&reviewed, 1, 1);
+		alpm_list_free(reviewed);
+		return ret == -2 ? ret : 0;
+	}
+
+	levels = xcalloc(nlevels, sizeof(alpm_list_t *));
+	for (i = reviewed; i; i = i->next) {
+		ret = level[graph_vertex_id(graph, i->data)];
+		levels[ret] = alpm_list_add(levels[ret], i->data);
+	}
+
+	ret = build_levels(levels, nlevels, config->buildjobs);
+
+	while (nlevels--) {
+		alpm_list_free(levels[nlevels]);
+	}
+
+	free(levels);
+	free(level);
+	alpm_list_free(reviewed);
+	return ret == -2 ? ret : 0;
 }
 
 /* Generates the list of packages we are going to install from the AUR, in
@@ -540,15 +439,15 @@ static int upgrade_pkgs(alpm_list_t *targets, struct pw_hashdb *hashdb)
 	/* Enable debugging resolution */
 	graph_enable_debug_resolve();
 
-	graph = graph_new((pw_hash_fn) sdbm, (pw_hashcmp_fn) strcmp);
+	graph = graph_new((pw_hash_fn) pw_strhash, intern_cmp);
 	topost = stack_new(sizeof(int));
 
 	for (i = targets; i; i = i->next) {
 		target_pkgs = alpm_list_add(target_pkgs, i->data);
 		/* Insert into outdated AUR packages to avoid dling up to date ones */
-		hash_insert(hashdb->aur_outdated, (void *) i->data);
+		hash_insert(hashdb->aur_outdated, (void *) intern(i->data));
 		/* Add the targets into graph to prevent those w/o deps to not get upgraded */
-		graph_add_vertex(graph, (void *) i->data);
+		graph_add_vertex(graph, (void *) intern(i->data));
 	}
 
 	printf("Resolving dependencies... Please wait\n");
@@ -564,7 +463,7 @@ static int upgrade_pkgs(alpm_list_t *targets, struct pw_hashdb *hashdb)
 
 	final_targets = topo_get_targets(hashdb, graph, topost);
 	if (final_targets) {
-		topo_install(hashdb, final_targets);
+		topo_install(hashdb, graph, final_targets);
 	}
 
 cleanup:
@@ -581,17 +480,21 @@ cleanup:
 }
 
 /* Returns a list of outdated AUR packages among targets or all AUR packages.
- * The list and the packages are to be freed by the caller.
+ * The list is to be freed by the caller. The packages in it belong to
+ * *aurpkgs, which is also to be freed by the caller.
  *
  * @param curl curl easy handle
  * @param targets list of strings (package names) that are _definitely_ AUR packages
+ * @param aurpkgs pointer to set to store all AUR packages queried
  */
 static alpm_list_t *get_outdated_pkgs(CURL *curl, struct pw_hashdb *hashdb,
-									  alpm_list_t *targets)
+									  alpm_list_t *targets,
+									  struct aurpkg_set **aurpkgs)
 {
 	alpm_list_t *i;
 	alpm_list_t *outdated_pkgs = NULL;
-	alpm_list_t *pkglist, *targs;
+	alpm_list_t *targs;
+	struct hashmap *aurpkg_table;
 	struct pkgpair pkgpair;
 	struct pkgpair *pkgpair_ptr;
 	struct aurpkg_t *aurpkg;
@@ -609,9 +512,12 @@ static alpm_list_t *get_outdated_pkgs(CURL *curl, struct pw_hashdb *hashdb,
 		alpm_list_free(tmp_targs);
 	}
 
+	/* Batch the queries instead of 1 round trip per package */
+	*aurpkgs = query_aur_multiinfo(curl, targs, &aurpkg_table);
+
 	for (i = targs; i; i = i->next) {
-		pkglist = query_aur(curl, i->data, AUR_QUERY_INFO);
-		if (!pkglist) {
+		aurpkg = hashmap_search(aurpkg_table, i->data);
+		if (!aurpkg) {
 			continue;
 		}
 
@@ -621,10 +527,10 @@ static alpm_list_t *get_outdated_pkgs(CURL *curl, struct pw_hashdb *hashdb,
 			/* Shouldn't happen */
 			pw_fprintf(PW_LOG_ERROR, stderr, "Unable to find AUR package \"%s\""
 					   "in hashdb!\n", i->data);
+			continue;
 		}
 
-		aurpkg = pkglist->data;
-		pkgver = alpm_pkg_get_version(pkgpair_ptr->pkg);
+		pkgver = alpm_pkg_get_version(pkgpair_get_pkg(pkgpair_ptr));
 		pkgname = i->data;
 
 		if (alpm_pkg_vercmp(aurpkg->version, pkgver) > 0) {
@@ -635,16 +541,13 @@ static alpm_list_t *get_outdated_pkgs(CURL *curl, struct pw_hashdb *hashdb,
 
 			/* Add to upgrade list */
 			outdated_pkgs = alpm_list_add(outdated_pkgs, aurpkg);
-			pkglist->data = NULL;
 		} else if (config->verbose) {
 			pw_printf(PW_LOG_INFO, "%s %s is up to date.\n", pkgname,
 					  pkgver);
 		}
-
-		alpm_list_free_inner(pkglist, (alpm_list_fn_free) aurpkg_free);
-		alpm_list_free(pkglist);
 	}
 
+	hashmap_free(aurpkg_table);
 	if (!targets) {
 		alpm_list_free(targs);
 	}
@@ -686,15 +589,16 @@ static int sync_upgrade(CURL *curl, alpm_list_t *targets)
 	}
 
 	alpm_list_t *outdated_pkgs = NULL;
+	struct aurpkg_set *aurpkgs = NULL;
 	if (!targets) {
 		/* Check all AUR packages */
-		outdated_pkgs = get_outdated_pkgs(curl, hashdb, NULL);
+		outdated_pkgs = get_outdated_pkgs(curl, hashdb, NULL, &aurpkgs);
 	} else {
 		if (!new_targs) {
 			goto cleanup;
 		}
 
-		outdated_pkgs = get_outdated_pkgs(curl, hashdb, new_targs);
+		outdated_pkgs = get_outdated_pkgs(curl, hashdb, new_targs, &aurpkgs);
 	}
 
 	if (!outdated_pkgs) {
@@ -726,8 +630,8 @@ static int sync_upgrade(CURL *curl, alpm_list_t *targets)
 	}
 
 cleanup:
-	alpm_list_free_inner(outdated_pkgs, (alpm_list_fn_free) aurpkg_free);
 	alpm_list_free(outdated_pkgs);
+	aurpkg_set_free(aurpkgs);
 	alpm_list_free(new_targs);
 	hashdb_free(hashdb);
 	return ret;
@@ -745,22 +649,26 @@ static int sync_targets(CURL *curl, alpm_list_t *targets)
 	alpm_pkg_t *lpkg;
 	alpm_list_t *i;
 	alpm_list_t *reinstall, *new_packages, *upgrade, *downgrade, *not_aur;
-	alpm_list_t *aurpkg_list, *final_targets;
+	alpm_list_t *final_targets;
+	struct aurpkg_set *aurpkgs = NULL;
+	struct hashmap *aurpkg_table = NULL;
 	int vercmp;
 	int joined = 0, ret = 0;
 
-	reinstall = new_packages = upgrade = downgrade = aurpkg_list = not_aur = NULL;
+	reinstall = new_packages = upgrade = downgrade = not_aur = NULL;
 	final_targets = NULL;
 	if (!hashdb) {
 		pw_fprintf(PW_LOG_ERROR, stderr, "Failed to create hashdb\n");
 		goto cleanup;
 	}
 
+	aurpkgs = query_aur_multiinfo(curl, targets, &aurpkg_table);
+
 	for (i = targets; i; i = i->next) {
-		aurpkg_list = query_aur(curl, i->data, AUR_QUERY_INFO);
-		if (!aurpkg_list) {
+		aurpkg = hashmap_search(aurpkg_table, i->data);
+		if (!aurpkg) {
 			not_aur = alpm_list_add(not_aur, i->data);
-			goto free_aurpkg;
+			continue;
 		}
 
 		/* Check version string */
@@ -769,8 +677,7 @@ static int sync_targets(CURL *curl, alpm_list_t *targets)
 
 		/* Locally installed AUR */
 		if (pkgpair_ptr) {
-			aurpkg = aurpkg_list->data;
-			lpkg = pkgpair_ptr->pkg;
+			lpkg = pkgpair_get_pkg(pkgpair_ptr);
 			vercmp = alpm_pkg_vercmp(aurpkg->version, alpm_pkg_get_version(lpkg));
 
 			if (vercmp > 0) {
@@ -783,10 +690,6 @@ static int sync_targets(CURL *curl, alpm_list_t *targets)
 		} else {
 			new_packages = alpm_list_add(new_packages, i->data);
 		}
-
-free_aurpkg:
-		alpm_list_free_inner(aurpkg_list, (alpm_list_fn_free) aurpkg_free);
-		alpm_list_free(aurpkg_list);
 	}
 
 	if (not_aur) {
@@ -824,6 +727,11 @@ free_aurpkg:
 	}
 
 cleanup:
+	if (aurpkg_table) {
+		hashmap_free(aurpkg_table);
+	}
+
+	aurpkg_set_free(aurpkgs);
 	hashdb_free(hashdb);
 	alpm_list_free(downgrade);
 	alpm_list_free(not_aur);
@@ -932,8 +840,8 @@ int powaur_maint(alpm_list_t *targets)
 	}
 
 	int ret;
-	size_t listsz;
-	alpm_list_t *i, *results;
+	unsigned int idx;
+	struct aurpkg_set *results;
 	struct aurpkg_t *pkg;
 	CURL *curl;
 
@@ -955,16 +863,12 @@ int powaur_maint(alpm_list_t *targets)
 		goto cleanup;
 	}
 
-	/* Sort by alphabetical order */
-	listsz = alpm_list_count(results);
-	results = alpm_list_msort(results, listsz, aurpkg_name_cmp);
-
-	if (config->sort_votes) {
-		results = alpm_list_msort(results, listsz, aurpkg_vote_cmp);
-	}
+	/* Sort by votes or alphabetical order */
+	aurpkg_set_sort(results, config->sort_votes ? aurpkg_vote_cmp :
+					aurpkg_name_cmp);
 
-	for (i = results; i; i = i->next) {
-		pkg = i->data;
+	for (idx = 0; idx < results->nr; ++idx) {
+		pkg = results->pkgs + idx;
 		printf("%saur/%s%s%s %s%s %s(%d)%s\n", color.bmag, color.nocolor,
 			   color.bold, pkg->name, color.bgreen, pkg->version,
 			   color.byellow, pkg->votes, color.nocolor);
@@ -972,8 +876,7 @@ int powaur_maint(alpm_list_t *targets)
 	}
 
 cleanup:
-	alpm_list_free_inner(results, (alpm_list_fn_free) aurpkg_free);
-	alpm_list_free(results);
+	aurpkg_set_free(results);
 	curl_easy_cleanup(curl);
 
 	return 0;
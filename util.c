@@ -1,6 +1,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdarg.h>
 #include <string.h>
 #include <time.h>
@@ -152,33 +153,33 @@ void color_print_restore(void)
 	pw_vfprintf = pw_safe_vfprintf;
 }
 
-/* Extracts the downloaded archive and removes it upon success.
- * Assumed to be in destination directory before calling this.
- * Returns -1 on fatal errors, > 0 on extraction errors, 0 on success.
+/* Creates a reader for any format and compression libarchive knows of.
+ * returns NULL if libarchive cannot allocate one.
  */
-int extract_file(const char *filename)
+struct archive *archive_reader_new(void)
 {
-	/* Extract the archive */
-	struct archive *archive;
-	struct archive_entry *entry;
-	int ret;
-	int errors = 0;
-	int extract_flags = ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_TIME;
-
-	archive = archive_read_new();
+	struct archive *archive = archive_read_new();
 	if (!archive) {
-		return error(PW_ERR_ARCHIVE_CREATE);
+		return NULL;
 	}
 
 	archive_read_support_compression_all(archive);
 	archive_read_support_format_all(archive);
-	ret = archive_read_open_filename(archive, filename, 16384);
+	return archive;
+}
 
-	if (ret != ARCHIVE_OK) {
-		return error(PW_ERR_ARCHIVE_OPEN);
-	}
+/* Extracts every entry of an opened archive into the current directory.
+ * The archive is freed whatever happens.
+ * Returns the number of entries which failed, plus 1 if reading stopped early.
+ */
+int extract_archive(struct archive *archive)
+{
+	struct archive_entry *entry;
+	int ret;
+	int errors = 0;
+	int extract_flags = ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_TIME;
 
-	while (archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
+	while ((ret = archive_read_next_header(archive, &entry)) == ARCHIVE_OK) {
 		ret = archive_read_extract(archive, entry, extract_flags);
 
 		if (ret == ARCHIVE_WARN && archive_errno(archive) != ENOSPC) {
@@ -198,13 +199,87 @@ int extract_file(const char *filename)
 		}
 	}
 
+	/* Truncated or failed reads */
+	if (ret != ARCHIVE_EOF && ret != ARCHIVE_OK) {
+		pw_fprintf(PW_LOG_ERROR, stderr, "Error reading archive: %s\n",
+				   archive_error_string(archive));
+		++errors;
+	}
+
 	archive_read_finish(archive);
+	return errors;
+}
+
+/* Extracts the downloaded archive and removes it upon success.
+ * Assumed to be in destination directory before calling this.
+ * Returns -1 on fatal errors, > 0 on extraction errors, 0 on success.
+ */
+int extract_file(const char *filename)
+{
+	/* Extract the archive */
+	struct archive *archive;
+	int ret;
+	int errors = 0;
+
+	archive = archive_reader_new();
+	if (!archive) {
+		return error(PW_ERR_ARCHIVE_CREATE);
+	}
+
+	ret = archive_read_open_filename(archive, filename, 16384);
+
+	if (ret != ARCHIVE_OK) {
+		archive_read_finish(archive);
+		return error(PW_ERR_ARCHIVE_OPEN);
+	}
+
+	errors = extract_archive(archive);
 
 	/* Everything successful. Remove the file */
 	unlink(filename);
 	return errors;
 }
 
+int rmrf(const char *path)
+{
+	struct stat st;
+	struct dirent *ent;
+	DIR *dir;
+	char buf[PATH_MAX];
+	int ret = 0;
+
+	if (lstat(path, &st)) {
+		return errno == ENOENT ? 0 : -1;
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		return unlink(path);
+	}
+
+	dir = opendir(path);
+	if (!dir) {
+		return -1;
+	}
+
+	while ((ent = readdir(dir))) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+			continue;
+		}
+
+		snprintf(buf, PATH_MAX, "%s/%s", path, ent->d_name);
+		if (rmrf(buf)) {
+			ret = -1;
+		}
+	}
+
+	closedir(dir);
+	if (rmdir(path)) {
+		ret = -1;
+	}
+
+	return ret;
+}
+
 /* Removes whitespace from both ends of a string */
 char *strtrim(char *line)
 {
@@ -744,6 +819,92 @@ unsigned long sdbm(const char *str)
 	return hash;
 }
 
+/* Per process seed for pw_strhash */
+static uint64_t pw_hash_seed = 0xa0761d6478bd642fULL;
+
+/* wyhash constants */
+#define WYP0 0xa0761d6478bd642fULL
+#define WYP1 0xe7037ed1a0b428dbULL
+
+void pw_hash_init(void)
+{
+	uint64_t seed = 0;
+	int fd = open("/dev/urandom", O_RDONLY);
+
+	if (fd >= 0) {
+		if (read(fd, &seed, sizeof(seed)) != sizeof(seed)) {
+			seed = 0;
+		}
+		close(fd);
+	}
+
+	if (!seed) {
+		seed = (uint64_t) time(NULL) ^ ((uint64_t) getpid() << 32);
+	}
+
+	pw_hash_seed ^= seed;
+}
+
+/* 64x64 -> 128 bit multiply, folded back to 64 bits */
+static inline uint64_t wymix(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t) a * b;
+	return (uint64_t) r ^ (uint64_t) (r >> 64);
+#else
+	uint64_t r = a * b;
+	return r ^ (r >> 32) ^ (a >> 29) * (b | 1);
+#endif
+}
+
+static inline uint64_t wyread8(const unsigned char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t wyread4(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* wyhash style, reads the string 8 bytes at a time */
+unsigned long pw_strhash(const char *str)
+{
+	const unsigned char *p = (const unsigned char *) str;
+	size_t len, left;
+	uint64_t a, b, seed = pw_hash_seed;
+
+	if (!str) {
+		return 0;
+	}
+
+	len = left = strlen(str);
+	while (left > 16) {
+		seed = wymix(wyread8(p) ^ WYP1, wyread8(p + 8) ^ seed);
+		p += 16;
+		left -= 16;
+	}
+
+	if (left > 8) {
+		a = wyread8(p);
+		b = wyread8(p + left - 8);
+	} else if (left >= 4) {
+		a = wyread4(p);
+		b = wyread4(p + left - 4);
+	} else if (left > 0) {
+		a = ((uint64_t) p[0] << 16) | ((uint64_t) p[left >> 1] << 8) | p[left - 1];
+		b = 0;
+	} else {
+		a = b = 0;
+	}
+
+	return (unsigned long) wymix(WYP1 ^ len, wymix(a ^ WYP1, b ^ seed ^ WYP0));
+}
+
 /* Writes a directory to an archive */
 static int write_dir_archive(char *dirname, struct archive *a)
 {
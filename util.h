@@ -30,7 +30,25 @@ void color_print_setup(void);
 /* Restore color printing functions to non-colorized versions */
 void color_print_restore(void);
 
+struct archive;
+
+/* returns a libarchive reader supporting all formats and compressions */
+struct archive *archive_reader_new(void);
+
+/* Extracts all entries of an opened archive into the current directory and
+ * frees the archive.
+ * returns the number of errors.
+ */
+int extract_archive(struct archive *archive);
+
 int extract_file(const char *filename);
+
+/* Removes path, and everything below it if it is a directory.
+ * Symbolic links are removed, not followed.
+ * returns 0 on success or if path does not exist, -1 otherwise.
+ */
+int rmrf(const char *path);
+
 int getcols(void);
 char *strtrim(char *line);
 /* Trims version from a string. ie, if you pass it "pacman>=3.5",
@@ -74,9 +92,19 @@ void color_repo(const char *repo);
 /* Prints groups in color */
 void color_groups(alpm_list_t *grp);
 
-/* sdbm string hashing function */
+/* sdbm string hashing function.
+ * Stable across runs, use it for anything that is saved to disk.
+ */
 unsigned long sdbm(const char *str);
 
+/* Seeds pw_strhash, call once before any hash table is created */
+void pw_hash_init(void);
+
+/* Seeded string hash used by the hash tables.
+ * Hashes differ from run to run, never save them.
+ */
+unsigned long pw_strhash(const char *str);
+
 #define MINI_BUFSZ 60
 
 #define ASSERT(somecond, someact) do {                               \